@@ -0,0 +1,301 @@
+#!/usr/bin/env python3
+
+############################################################
+#                   CHEMISTRY COMPILER                     #
+############################################################
+#
+# Translates the Elements and Reactions of a load file into
+# a C++ header of constant tables, which 'make
+# metabolism-chemistry' compiles into a simulator
+# specialised for that chemistry.
+#
+# Usage: compile_chemistry.py LOADFILE HEADER
+#
+# The load file is read the same way as by
+# Sim::loadChemistry, and the tables are laid out as
+# Sim::compileRxnTable lays out rxnPairs and
+# rxnThresholds, so that the
+# specialised simulator can check at startup that it has
+# been given the chemistry it was compiled for.  The header
+# is only rewritten if its contents change.
+
+import sys
+
+# Limits of the simulator (see sim.h)
+MIN_RXN_CHANNELS = 2
+MAX_ELES_NOT_INCLUDING_SOLVENT = 255
+
+############################################################
+
+def fail(message):
+   """Print an error message in the style of the simulator and exit."""
+
+   sys.stderr.write(message + "\n")
+   sys.exit(1)
+
+############################################################
+
+def parseSpecies(tokens, names):
+   """Parse one side of a reaction.
+   Takes as arguments
+      tokens: the words making up the side of the reaction, e.g.,
+         ["2", "A", "+", "B"]
+      names:  the names of the defined Elements
+   Returns
+      a list of Element names, in the order in which Sim::loadChemistry
+         stores them (sorted by name, with Solvent left out)"""
+
+   species = []
+   for term in " ".join(tokens).split("+"):
+      words = term.split()
+      n = 1
+      if len(words) > 1:
+         try:
+            n = int(words[0])
+         except ValueError:
+            fail("Loading rxn: confused by \"%s\"!" % term.strip())
+         words = words[1:]
+      if len(words) != 1:
+         fail("Loading rxn: confused by \"%s\"!" % term.strip())
+      word = words[0]
+      if word != "*" and word != "Solvent":
+         if word not in names:
+            fail("Loading rxn: %s is not a defined Element!" % word)
+         species += [word] * n
+
+   return sorted(species)
+
+############################################################
+
+def loadChemistry(path):
+   """Read the Elements and Reactions of a load file.
+   Takes as arguments
+      path: the name of the load file
+   Returns
+      names: the names of the Elements, in order of their compact indices
+         (Solvent first, then the rest sorted by name, as Sim numbers them)
+      rxns:  the Reactions as (prob, reactants, products) tuples, in the
+         order in which they appear, with reactants and products padded
+         with Solvent to the same length"""
+
+   names = ["Solvent"]
+   rxns = []
+
+   try:
+      lines = open(path).read().splitlines()
+   except IOError:
+      fail("Can't open load file %s!" % path)
+
+   for line in lines:
+      words = line.split()
+      if len(words) == 0 or line.startswith("#"):
+         continue
+
+      # Read in Elements
+      if words[0] == "ele":
+         if len(words) < 5:
+            fail("Loading ele: too few fields in \"%s\"!" % line)
+         names.append(words[1])
+         if len(names) - 1 > MAX_ELES_NOT_INCLUDING_SOLVENT:
+            fail("Loading ele: limit of %d Elements exceeded!" % MAX_ELES_NOT_INCLUDING_SOLVENT)
+
+      # Read in Reactions
+      if words[0] == "rxn":
+         if "->" not in words:
+            fail("Loading rxn: premature line-break, was expecting \"->\"!")
+         arrow = words.index("->")
+         prob = float(words[1])
+         reactants = parseSpecies(words[2:arrow], names)
+         products = parseSpecies(words[arrow+1:], names)
+         while len(reactants) < len(products):
+            reactants.append("Solvent")
+         while len(products) < len(reactants):
+            products.append("Solvent")
+         rxns.append((prob, reactants, products))
+
+   names = names[:1] + sorted(names[1:])
+   return names, rxns
+
+############################################################
+
+def probThreshold(prob):
+   """Find the smallest integer u such that the reaction test
+   (double)u / 2^61 < prob fails, exactly as Sim::probThreshold does."""
+
+   scale = 2**61
+   lo = 0
+   hi = scale
+   while lo < hi:
+      mid = lo + (hi - lo) // 2
+      if float(mid) / float(scale) < prob:
+         lo = mid + 1
+      else:
+         hi = mid
+   return lo
+
+############################################################
+
+def compileRxnTable(names, rxns):
+   """Lay out the reaction tables as Sim::compileRxnTable does.
+   Takes as arguments
+      names: the names of the Elements, Solvent first
+      rxns:  the Reactions returned by loadChemistry
+   Returns
+      channels:   the number of channels of each pair of reactants
+      entries:    the index of the first threshold of each pair
+      pairs:      the pair numbers indexed by a * (nIndices + 1) + b, where
+         nIndices is the number of Elements and b == nIndices stands for
+         first-order reactions
+      thresholds: the thresholds indexed by entries[pair] + channel"""
+
+   nIndices = len(names)
+   index = dict((name, i) for i, name in enumerate(names))
+
+   # Group the Reactions by their unordered pairs of reactants,
+   # keeping the order of the load file
+   groups = {}
+   for prob, reactants, products in rxns:
+      a = index[reactants[0]]
+      b = index[reactants[1]] if len(reactants) > 1 else nIndices
+      groups.setdefault((min(a, b), max(a, b)), []).append(prob)
+
+   # Number the pairs that have Reactions, with pair 0 having none
+   pairs = []
+   numbers = {}
+   order = [None]
+   for a in range(nIndices):
+      for b in range(nIndices + 1):
+         pair = (min(a, b), max(a, b))
+         if pair not in groups:
+            pairs.append(0)
+            continue
+         if pair not in numbers:
+            numbers[pair] = len(order)
+            order.append(pair)
+         pairs.append(numbers[pair])
+
+   # Each pair has a channel for each of its Reactions, and no
+   # fewer than MIN_RXN_CHANNELS, avoiding multiples of 5
+   channels = []
+   entries = []
+   thresholds = []
+   for pair in order:
+      probs = groups[pair] if pair is not None else []
+      n = max(MIN_RXN_CHANNELS, len(probs))
+      while n % 5 == 0:
+         n += 1
+      channels.append(n)
+      entries.append(len(thresholds))
+      for channel in range(n):
+         if channel < len(probs):
+            thresholds.append(probThreshold(probs[channel]))
+         else:
+            thresholds.append(0)
+
+   return channels, entries, pairs, thresholds
+
+############################################################
+
+def writeHeader(path, loadFile, names, rxns, channels, entries, pairs, thresholds):
+   """Write the compiled chemistry to a C++ header, leaving the file
+   untouched if it already holds the same contents."""
+
+   nIndices = len(names)
+   nPairs = len(channels)
+   secondOrder = any(len(reactants) > 1 for prob, reactants, products in rxns)
+
+   lines = []
+   lines.append("/* compiled-chemistry.h")
+   lines.append(" * Generated by compile_chemistry.py from %s; do not edit" % loadFile)
+   lines.append(" */")
+   lines.append("")
+   lines.append("#ifndef COMPILED_CHEMISTRY_H")
+   lines.append("#define COMPILED_CHEMISTRY_H 1")
+   lines.append("")
+   lines.append("#include <stdint.h>")
+   lines.append("")
+   lines.append("// The load file the chemistry was compiled from")
+   lines.append("#define COMPILED_CHEMISTRY \"%s\"" % loadFile)
+   lines.append("")
+   lines.append("// The number of Elements, including Solvent, the most")
+   lines.append("// channels of any pair of reactants, the number of pairs,")
+   lines.append("// including the pair without Reactions, and the number")
+   lines.append("// of channels of all the pairs together")
+   lines.append("#define COMPILED_ELEMENTS %d" % nIndices)
+   lines.append("#define COMPILED_CHANNELS %d" % max(channels))
+   lines.append("#define COMPILED_PAIRS %d" % nPairs)
+   lines.append("#define COMPILED_RXN_ENTRIES %d" % len(thresholds))
+   lines.append("")
+   lines.append("// Whether any Reaction has two reactants")
+   lines.append("#define COMPILED_SECOND_ORDER %s" % ("true" if secondOrder else "false"))
+   lines.append("")
+   lines.append("// The names of the Elements by compact index")
+   lines.append("static const char* const compiledElementNames[ COMPILED_ELEMENTS ] =")
+   lines.append("{")
+   for name in names:
+      lines.append("   \"%s\"," % name)
+   lines.append("};")
+   lines.append("")
+   lines.append("// Whether an atom of each Element can take part in any")
+   lines.append("// Reaction as the atom attempting it")
+   lines.append("static const bool compiledReactive[ COMPILED_ELEMENTS ] =")
+   lines.append("{")
+   for a in range(nIndices):
+      reactive = any(pairs[a * (nIndices + 1) : (a + 1) * (nIndices + 1)])
+      lines.append("   %-6s // %s" % ("true," if reactive else "false,", names[a]))
+   lines.append("};")
+   lines.append("")
+   lines.append("// The pair numbers, laid out as rxnPairs and padded by")
+   lines.append("// one entry")
+   lines.append("static const uint16_t compiledRxnPairs[ COMPILED_ELEMENTS * ( COMPILED_ELEMENTS + 1 ) + 1 ] =")
+   lines.append("{")
+   for a in range(nIndices):
+      row = pairs[a * (nIndices + 1) : (a + 1) * (nIndices + 1)]
+      lines.append("   %s, // %s" % (", ".join("%d" % p for p in row), names[a]))
+   lines.append("   0,")
+   lines.append("};")
+   lines.append("")
+   lines.append("// The number of channels of each pair and the index of")
+   lines.append("// its first channel, as rxnPairChannels and rxnPairEntries")
+   lines.append("static const int compiledRxnPairChannels[ COMPILED_PAIRS ] =")
+   lines.append("{")
+   lines.append("   %s," % ", ".join("%d" % n for n in channels))
+   lines.append("};")
+   lines.append("static const int compiledRxnPairEntries[ COMPILED_PAIRS ] =")
+   lines.append("{")
+   lines.append("   %s," % ", ".join("%d" % n for n in entries))
+   lines.append("};")
+   lines.append("")
+   lines.append("// The reaction thresholds, laid out as rxnThresholds")
+   lines.append("static const uint64_t compiledRxnThresholds[ COMPILED_RXN_ENTRIES ] =")
+   lines.append("{")
+   for pair in range(nPairs):
+      values = thresholds[entries[pair] : entries[pair] + channels[pair]]
+      lines.append("   %s, // pair %d" % (", ".join("0x%016xull" % v for v in values), pair))
+   lines.append("};")
+   lines.append("")
+   lines.append("#endif")
+   lines.append("")
+   lines.append("// End")
+   contents = "\n".join(lines) + "\n"
+
+   try:
+      if open(path).read() == contents:
+         return
+   except IOError:
+      pass
+   open(path, "w").write(contents)
+
+############################################################
+
+if __name__ == "__main__":
+
+   if len(sys.argv) != 3:
+      fail("Usage: compile_chemistry.py LOADFILE HEADER")
+
+   names, rxns = loadChemistry(sys.argv[1])
+   channels, entries, pairs, thresholds = compileRxnTable(names, rxns)
+   writeHeader(sys.argv[2], sys.argv[1], names, rxns, channels, entries, pairs, thresholds)
+
+
+# End
@@ -0,0 +1,136 @@
+/* arena.cpp
+ */
+
+#include <cstdlib> // exit, malloc, free
+#include <iostream>
+#ifdef BLR_USELINUX
+#include <sys/mman.h> // madvise, mmap, munmap
+#endif
+#include "arena.h"
+
+
+// Constructor
+Arena::Arena()
+{
+   used = 0;
+   requested = 0;
+}
+
+
+// Deconstructor
+Arena::~Arena()
+{
+   for( unsigned int i = 0; i < blocks.size(); i++ )
+      freeBlock( blocks[ i ] );
+}
+
+
+// Returns a buffer of the given number of bytes, aligned
+// to ALIGNMENT; its contents are undefined
+void*
+Arena::allocate( size_t bytes )
+{
+   bytes = ( bytes + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT;
+   requested += bytes;
+   if( blocks.empty() || used + bytes > blocks.back().size )
+      addBlock( bytes );
+
+   void* buffer = blocks.back().base + used;
+   used += bytes;
+   return buffer;
+}
+
+
+// Give back every buffer at once.  If the last world
+// needed more than one block, they are replaced by a
+// single block large enough for all of it, so that the
+// next world of the same size lies in one region.
+void
+Arena::reset()
+{
+   if( blocks.size() > 1 )
+   {
+      for( unsigned int i = 0; i < blocks.size(); i++ )
+         freeBlock( blocks[ i ] );
+      blocks.clear();
+      addBlock( requested );
+   }
+   used = 0;
+   requested = 0;
+}
+
+
+// Returns the number of bytes held by the arena
+size_t
+Arena::getCapacity()
+{
+   size_t capacity = 0;
+   for( unsigned int i = 0; i < blocks.size(); i++ )
+      capacity += blocks[ i ].size;
+   return capacity;
+}
+
+
+// Add a block of at least the given number of bytes,
+// rounded up to whole huge pages.  On Linux, explicit huge
+// pages are used if any have been reserved; otherwise the
+// block is aligned to a huge page and transparent huge
+// pages are requested for it.
+void
+Arena::addBlock( size_t bytes )
+{
+   Block block;
+   block.size = ( bytes + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+   if( block.size == 0 )
+      block.size = HUGE_PAGE_SIZE;
+   block.base = NULL;
+   block.allocation = NULL;
+
+#ifdef BLR_USELINUX
+   void* region = mmap( NULL, block.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+   if( region != MAP_FAILED )
+   {
+      block.base = (char*)region;
+   }
+   else
+   {
+      // Map a huge page more than needed and trim the ends
+      // so that the block starts on a huge page boundary
+      region = mmap( NULL, block.size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+      if( region != MAP_FAILED )
+      {
+         char* start = (char*)region;
+         char* aligned = (char*)( ( (size_t)start + HUGE_PAGE_SIZE - 1 ) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE );
+         if( aligned > start )
+            munmap( start, aligned - start );
+         munmap( aligned + block.size, start + HUGE_PAGE_SIZE - aligned );
+         madvise( aligned, block.size, MADV_HUGEPAGE );
+         block.base = aligned;
+      }
+   }
+#else
+   block.allocation = malloc( block.size + ALIGNMENT );
+   if( block.allocation != NULL )
+      block.base = (char*)( ( (size_t)block.allocation + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT );
+#endif
+
+   if( block.base == NULL )
+   {
+      std::cerr << "Arena: unable to allocate " << block.size << " bytes!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   blocks.push_back( block );
+   used = 0;
+}
+
+
+// Return a block to the system
+void
+Arena::freeBlock( Block& block )
+{
+#ifdef BLR_USELINUX
+   munmap( block.base, block.size );
+#else
+   free( block.allocation );
+#endif
+}
@@ -0,0 +1,56 @@
+/* arena.h
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <vector>
+
+// A region of memory from which the large buffers of one
+// world are carved.  It is backed by huge pages where the
+// system offers them, so that the scattered accesses of
+// the kernels miss the TLB less often, and every buffer is
+// aligned for SIMD loads.  The buffers are given back all
+// at once by reset, and the region is kept for the next
+// world.
+class Arena
+{
+   public:
+      // Constructor
+      Arena();
+
+      // Deconstructor
+      ~Arena();
+
+      void* allocate( size_t bytes );
+      void reset();
+      size_t getCapacity();
+
+      static const size_t ALIGNMENT = 64;
+      static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+   private:
+      // The region grows by adding blocks when a world needs
+      // more than it holds; used counts the bytes taken from
+      // the last block, and requested those taken by the
+      // current world from all of them
+      struct Block
+      {
+         char* base;
+         size_t size;
+         void* allocation;
+      };
+      std::vector<Block> blocks;
+      size_t used;
+      size_t requested;
+
+      void addBlock( size_t bytes );
+      void freeBlock( Block& block );
+
+      // Not copyable
+      Arena( const Arena& );
+      Arena& operator=( const Arena& );
+};
+
+#endif /* ARENA_H */
@@ -1,9 +1,18 @@
 /* atom.cpp
  */
 
+#include <new>
 #include "atom.h"
 
 
+// The pool of memory for Atoms: deleted Atoms are kept on a
+// free list for reuse, and new ones are carved from chunks
+// of POOL_CHUNK Atoms, which are never given back
+void* Atom::freeAtoms = NULL;
+char* Atom::poolChunk = NULL;
+int Atom::poolChunkUsed = Atom::POOL_CHUNK;
+
+
 // Constructor
 Atom::Atom( Element* initType, int initX, int initY )
 {
@@ -33,6 +42,43 @@ Atom::~Atom()
 }
 
 
+void*
+Atom::operator new( size_t size )
+{
+   if( size != sizeof( Atom ) )
+      return ::operator new( size );
+
+   if( freeAtoms != NULL )
+   {
+      void* p = freeAtoms;
+      freeAtoms = *(void**)p;
+      return p;
+   }
+
+   if( poolChunkUsed == POOL_CHUNK )
+   {
+      poolChunk = (char*)::operator new( POOL_CHUNK * sizeof( Atom ) );
+      poolChunkUsed = 0;
+   }
+   return poolChunk + sizeof( Atom ) * poolChunkUsed++;
+}
+
+
+void
+Atom::operator delete( void* p, size_t size )
+{
+   if( p == NULL )
+      return;
+   if( size != sizeof( Atom ) )
+   {
+      ::operator delete( p );
+      return;
+   }
+   *(void**)p = freeAtoms;
+   freeAtoms = p;
+}
+
+
 Element*
 Atom::getType()
 {
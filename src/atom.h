@@ -4,6 +4,7 @@
 #ifndef ATOM_H
 #define ATOM_H 
 
+#include <stddef.h>
 #include "element.h"
 
 class Atom
@@ -15,6 +16,11 @@ class Atom
       // Deconstructor
       ~Atom();
 
+      // Atoms are allocated from a pool rather than one at a
+      // time from the heap
+      static void* operator new( size_t size );
+      static void operator delete( void* p, size_t size );
+
       // Get and set functions
       Element* getType();
       void setType( Element* newType );
@@ -34,6 +40,11 @@ class Atom
       // Atom attributes
       Element* type;
       bool tracked;
+
+      static const int POOL_CHUNK = 65536;
+      static void* freeAtoms;
+      static char* poolChunk;
+      static int poolChunkUsed;
 };
 
 #endif /* ATOM_H */
@@ -0,0 +1,85 @@
+/* compiled-chemistry.h
+ * Generated by compile_chemistry.py from /tmp/cc/three.load; do not edit
+ */
+
+#ifndef COMPILED_CHEMISTRY_H
+#define COMPILED_CHEMISTRY_H 1
+
+#include <stdint.h>
+
+// The load file the chemistry was compiled from
+#define COMPILED_CHEMISTRY "/tmp/cc/three.load"
+
+// The number of Elements, including Solvent, the most
+// channels of any pair of reactants, the number of pairs,
+// including the pair without Reactions, and the number
+// of channels of all the pairs together
+#define COMPILED_ELEMENTS 7
+#define COMPILED_CHANNELS 3
+#define COMPILED_PAIRS 3
+#define COMPILED_RXN_ENTRIES 7
+
+// Whether any Reaction has two reactants
+#define COMPILED_SECOND_ORDER false
+
+// The names of the Elements by compact index
+static const char* const compiledElementNames[ COMPILED_ELEMENTS ] =
+{
+   "Solvent",
+   "Ant",
+   "Bee",
+   "Cat",
+   "Dog",
+   "Xray",
+   "Yak",
+};
+
+// Whether an atom of each Element can take part in any
+// Reaction as the atom attempting it
+static const bool compiledReactive[ COMPILED_ELEMENTS ] =
+{
+   false, // Solvent
+   true,  // Ant
+   false, // Bee
+   false, // Cat
+   false, // Dog
+   true,  // Xray
+   false, // Yak
+};
+
+// The pair numbers, laid out as rxnPairs and padded by
+// one entry
+static const uint16_t compiledRxnPairs[ COMPILED_ELEMENTS * ( COMPILED_ELEMENTS + 1 ) + 1 ] =
+{
+   0, 0, 0, 0, 0, 0, 0, 0, // Solvent
+   0, 0, 0, 0, 0, 0, 0, 1, // Ant
+   0, 0, 0, 0, 0, 0, 0, 0, // Bee
+   0, 0, 0, 0, 0, 0, 0, 0, // Cat
+   0, 0, 0, 0, 0, 0, 0, 0, // Dog
+   0, 0, 0, 0, 0, 0, 0, 2, // Xray
+   0, 0, 0, 0, 0, 0, 0, 0, // Yak
+   0,
+};
+
+// The number of channels of each pair and the index of
+// its first channel, as rxnPairChannels and rxnPairEntries
+static const int compiledRxnPairChannels[ COMPILED_PAIRS ] =
+{
+   2, 3, 2,
+};
+static const int compiledRxnPairEntries[ COMPILED_PAIRS ] =
+{
+   0, 2, 5,
+};
+
+// The reaction thresholds, laid out as rxnThresholds
+static const uint64_t compiledRxnThresholds[ COMPILED_RXN_ENTRIES ] =
+{
+   0x0000000000000000ull, 0x0000000000000000ull, // pair 0
+   0x0333333333333330ull, 0x0333333333333330ull, 0x0333333333333330ull, // pair 1
+   0x0333333333333330ull, 0x0000000000000000ull, // pair 2
+};
+
+#endif
+
+// End
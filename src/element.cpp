@@ -12,6 +12,7 @@
 Element::Element( std::string initName, char initSymbol, std::string initColor, double initStartConc )
 {
    static int lastPrime = 1;
+   static int lastIndex = -1;
 
    // Ensure that concentration is sane
    if( initStartConc < 0 || initStartConc > 1 )
@@ -38,6 +39,12 @@ Element::Element( std::string initName, char initSymbol, std::string initColor,
    lastPrime = candidate;
    key = lastPrime;
 
+   // Assign the next compact index for the Element; the
+   // first Element created (Solvent) receives index 0, and
+   // Sim renumbers the rest in name order once all are loaded
+   lastIndex++;
+   index = lastIndex;
+
    // Copy constructor arguments
    name = initName;
    symbol = initSymbol;
@@ -55,6 +62,20 @@ Element::getKey()
 }
 
 
+int
+Element::getIndex()
+{
+   return index;
+}
+
+
+void
+Element::setIndex( int newIndex )
+{
+   index = newIndex;
+}
+
+
 std::string
 Element::getName()
 {
@@ -4,6 +4,7 @@
 #ifndef ELEMENT_H
 #define ELEMENT_H 
 
+#include <stdint.h>
 #include <string>
 
 class Element
@@ -14,6 +15,8 @@ class Element
 
       // Get and set functions
       int getKey();
+      int getIndex();
+      void setIndex( int newIndex );
       std::string getName();
       void setName( std::string newName );
       char getSymbol();
@@ -23,11 +26,12 @@ class Element
       double getStartConc();
       void setStartConc( double newStartConc );
 
-      int count;
+      int64_t count;
 
    private:
       // Element attributes
       int key;
+      int index;
       std::string name;
       char symbol;
       std::string color;
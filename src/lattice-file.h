@@ -0,0 +1,79 @@
+/* lattice-file.h
+ */
+
+#ifndef LATTICE_FILE_H
+#define LATTICE_FILE_H
+
+#include <stdint.h>
+
+// The layout of the file written with --lattice-file.  The
+// simulation keeps its lattice in the file, mapped into
+// memory, so that other programs can map the file read-only
+// and see the world as it runs without copying it, and a
+// snapshot is a copy of the file.  This header depends only
+// on stdint.h, so that readers written in C can include it.
+//
+// The file begins with a LatticeFileHeader.  The lattice
+// follows at latticeOffset and holds latticeSize bytes, one
+// for each position (and for the padding of the tiles), each
+// the index of the Element at that position in the species
+// table; index 0 is Solvent.  The lattice is stored in
+// tiles of tileW x tileH positions, so that with
+//    tilesX = ( worldX + tileW - 1 ) / tileW
+// position (x,y) is at
+//    ( y / tileH ) * tilesX * tileW * tileH + ( y % tileH ) * tileW
+//    + ( x / tileW ) * tileW * tileH + x % tileW
+// which with tileH = 1 and tileW = worldX is x + y * worldX.
+//
+// If statsOffset is not 0, an array of worldX * worldY
+// LatticeFileStats follows at statsOffset, indexed by
+// x + y * worldX, holding the statistics of the atom at each
+// position as written to the diffusion file.  These are
+// filled in only when the simulation ends.
+//
+// sequence is odd while an iteration is changing the
+// lattice.  A reader wanting a consistent copy reads
+// sequence, copies the lattice, and reads sequence again;
+// the copy is consistent if both values are equal and even,
+// and is the world after iteration iterations.
+#define LATTICE_FILE_MAGIC "METLAT1"
+#define LATTICE_FILE_VERSION 1
+#define LATTICE_FILE_MAX_SPECIES 256
+#define LATTICE_FILE_NAME_LENGTH 32
+#define LATTICE_FILE_COLOR_LENGTH 31
+
+typedef struct LatticeFileSpecies
+{
+   char name[ LATTICE_FILE_NAME_LENGTH ];
+   char symbol;
+   char color[ LATTICE_FILE_COLOR_LENGTH ];
+} LatticeFileSpecies;
+
+typedef struct LatticeFileHeader
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t headerSize;
+   int32_t worldX;
+   int32_t worldY;
+   int32_t tileW;
+   int32_t tileH;
+   uint64_t latticeOffset;
+   uint64_t latticeSize;
+   uint64_t statsOffset;
+   uint32_t nSpecies;
+   int32_t iteration;
+   volatile uint64_t sequence;
+   LatticeFileSpecies species[ LATTICE_FILE_MAX_SPECIES ];
+} LatticeFileHeader;
+
+typedef struct LatticeFileStats
+{
+   int32_t dxActual;
+   int32_t dyActual;
+   int32_t dxIdeal;
+   int32_t dyIdeal;
+   int32_t collisions;
+} LatticeFileStats;
+
+#endif /* LATTICE_FILE_H */
@@ -9,6 +9,9 @@
 #ifdef HAVE_NCURSES
 #include <ncurses.h>
 #endif
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
 #include "options.h"
 #include "sim.h"
 
@@ -38,6 +41,11 @@ main( int argc, char* argv[] )
    //QApplication::setStyle( new QMotifStyle() );
 #endif
 
+#ifdef HAVE_MPI
+   // Start MPI, which may alter the command line
+   MPI_Init( &argc, &argv );
+#endif
+
    // Import command line options and initialize the simulation
    o = new Options( argc, argv );
    sim = new Sim( o );
@@ -78,6 +86,10 @@ main( int argc, char* argv[] )
    if( o->progress )
       sim->finishProgressReport();
 
+#ifdef HAVE_MPI
+   MPI_Finalize();
+#endif
+
    return retval;
 }
 
@@ -27,6 +27,21 @@ Options::Options( int argc, char* argv[] )
 #endif
    doRxns = true;
    doShuffle = false;
+   doSIMD = true;
+   doSkip = true;
+   doFused = false;
+   doTiled = false;
+   doBitplanes = false;
+   doDiffusion = true;
+   doKMC = false;
+   lean = false;
+   classicBuild = false;
+   numa = false;
+   pin = false;
+   rngThread = true;
+   autotune = false;
+   ssa = SSA_OFF;
+   doWellMixed = false;
    sleep = 0;
    verbose = false;
    progress = true;
@@ -36,6 +51,9 @@ Options::Options( int argc, char* argv[] )
    filePaths[ FILE_CENSUS ] = "census.out";
    filePaths[ FILE_DIFFUSION ] = "diffusion.out";
    filePaths[ FILE_RAND ] = "rand.out";
+   expectedPath = "";
+   latticePath = "";
+   tunePath = "";
 
    // Options that take only long-opt form should be indexed here.
    // In order to not clash with single-letter options, start from
@@ -43,8 +61,26 @@ Options::Options( int argc, char* argv[] )
    enum
    {
       OPT_GUI_NCURSES = 'z' + 1,
+      OPT_AUTOTUNE,
+      OPT_BITPLANES,
+      OPT_CLASSIC_BUILD,
+      OPT_DIFFUSION_OFF,
+      OPT_EXPECTED,
+      OPT_FUSED,
+      OPT_KMC,
+      OPT_LATTICE_FILE,
+      OPT_LEAN,
+      OPT_NUMA,
+      OPT_PIN,
+      OPT_RNG_THREAD_OFF,
       OPT_RXNS_ON,
-      OPT_SHUFFLE_OFF
+      OPT_SHUFFLE_OFF,
+      OPT_SIMD_OFF,
+      OPT_SKIP_OFF,
+      OPT_SSA,
+      OPT_TILED,
+      OPT_TUNE_FILE,
+      OPT_WELL_MIXED
    };
 
    // Any options that take long-opt form should be stored here.
@@ -71,8 +107,26 @@ Options::Options( int argc, char* argv[] )
 #if defined(HAVE_QT) & defined(HAVE_NCURSES)
       { "gui-ncurses",  no_argument,       NULL, OPT_GUI_NCURSES },
 #endif
+      { "autotune",     no_argument,       NULL, OPT_AUTOTUNE },
+      { "bitplanes",    no_argument,       NULL, OPT_BITPLANES },
+      { "classic-build", no_argument,      NULL, OPT_CLASSIC_BUILD },
+      { "diffusion-off", no_argument,      NULL, OPT_DIFFUSION_OFF },
+      { "expected",     required_argument, NULL, OPT_EXPECTED },
+      { "fused",        no_argument,       NULL, OPT_FUSED },
+      { "kmc",          no_argument,       NULL, OPT_KMC },
+      { "lattice-file", required_argument, NULL, OPT_LATTICE_FILE },
+      { "lean",         no_argument,       NULL, OPT_LEAN },
+      { "numa",         no_argument,       NULL, OPT_NUMA },
+      { "pin",          no_argument,       NULL, OPT_PIN },
+      { "rng-thread-off", no_argument,     NULL, OPT_RNG_THREAD_OFF },
       { "rxns-on",      no_argument,       NULL, OPT_RXNS_ON },
-      { "shuffle-off",  no_argument,       NULL, OPT_SHUFFLE_OFF }
+      { "shuffle-off",  no_argument,       NULL, OPT_SHUFFLE_OFF },
+      { "simd-off",     no_argument,       NULL, OPT_SIMD_OFF },
+      { "skip-off",     no_argument,       NULL, OPT_SKIP_OFF },
+      { "ssa",          required_argument, NULL, OPT_SSA },
+      { "tiled",        no_argument,       NULL, OPT_TILED },
+      { "tune-file",    required_argument, NULL, OPT_TUNE_FILE },
+      { "well-mixed",   no_argument,       NULL, OPT_WELL_MIXED }
    };
 
    // Any options that take short-opt form should be listed here.
@@ -96,6 +150,8 @@ Options::Options( int argc, char* argv[] )
    std::ifstream load;
    std::string keyword;
    std::string onOrOff;
+   bool versionLoaded = false;
+   bool buildLoaded = false;
 
    // First pass through arguments to look for --load option
    while( true )
@@ -134,6 +190,7 @@ Options::Options( int argc, char* argv[] )
 
                if( keyword == "version" || keyword == "ele" || keyword == "rxn" || keyword == "extinct" )
                {
+                  versionLoaded = versionLoaded || ( keyword == "version" );
                   loadFile.ignore(1024,'\n');
                }
                else
@@ -208,14 +265,61 @@ Options::Options( int argc, char* argv[] )
                                  }
                                  else
                                  {
-                                    if( keyword == "" )
+                                    if( keyword == "engine" )
                                     {
-                                       break;
+                                       std::string engine = "";
+                                       loadFile >> engine;
+                                       doBitplanes = ( engine == "bitplanes" );
+                                       doFused = ( engine == "fused" );
+                                       if( engine != "bytes" && !doBitplanes && !doFused )
+                                       {
+                                          std::cerr << "Load settings: \"engine\" must have value \"bytes\", \"bitplanes\" or \"fused\"!" << std::endl;
+                                          exit( EXIT_FAILURE );
+                                       }
                                     }
                                     else
                                     {
-                                       std::cerr << "Load settings: Unrecognized keyword \"" << keyword << "\"!" << std::endl;
-                                       exit( EXIT_FAILURE );
+                                       if( keyword == "tiled" || keyword == "simd" )
+                                       {
+                                          onOrOff = "";
+                                          loadFile >> onOrOff;
+                                          if( onOrOff != "on" && onOrOff != "off" )
+                                          {
+                                             std::cerr << "Load settings: \"" << keyword << "\" must have value \"on\" or \"off\"!" << std::endl;
+                                             exit( EXIT_FAILURE );
+                                          }
+                                          if( keyword == "tiled" )
+                                             doTiled = ( onOrOff == "on" );
+                                          else
+                                             doSIMD = ( onOrOff == "on" );
+                                       }
+                                       else
+                                       {
+                                          if( keyword == "build" )
+                                          {
+                                             std::string build = "";
+                                             loadFile >> build;
+                                             if( build != "classic" && build != "sampled" )
+                                             {
+                                                std::cerr << "Load settings: \"build\" must have value \"classic\" or \"sampled\"!" << std::endl;
+                                                exit( EXIT_FAILURE );
+                                             }
+                                             classicBuild = ( build == "classic" );
+                                             buildLoaded = true;
+                                          }
+                                          else
+                                          {
+                                             if( keyword == "" )
+                                             {
+                                                break;
+                                             }
+                                             else
+                                             {
+                                                std::cerr << "Load settings: Unrecognized keyword \"" << keyword << "\"!" << std::endl;
+                                                exit( EXIT_FAILURE );
+                                             }
+                                          }
+                                       }
                                     }
                                  }
                               }
@@ -227,6 +331,13 @@ Options::Options( int argc, char* argv[] )
                keyword = "";
             }
 
+            // A config file written before the build was
+            // recorded was built the classic way
+            if( versionLoaded && !buildLoaded )
+            {
+               classicBuild = true;
+            }
+
             // When all is done, reload the file so
             // that loadChemistry can scan it again
             loadFile.close();
@@ -345,18 +456,167 @@ Options::Options( int argc, char* argv[] )
             gui = GUI_NCURSES;
             break;
 #endif
+         case OPT_AUTOTUNE:
+            autotune = true;
+            break;
+         case OPT_BITPLANES:
+            doBitplanes = true;
+            break;
+         case OPT_CLASSIC_BUILD:
+            classicBuild = true;
+            break;
+         case OPT_DIFFUSION_OFF:
+            doDiffusion = false;
+            break;
+         case OPT_EXPECTED:
+            expectedPath = optarg;
+            break;
+         case OPT_LATTICE_FILE:
+            latticePath = optarg;
+            break;
+         case OPT_FUSED:
+            doFused = true;
+            break;
+         case OPT_KMC:
+            doKMC = true;
+            break;
+         case OPT_LEAN:
+            lean = true;
+            break;
+         case OPT_NUMA:
+            numa = true;
+            break;
+         case OPT_PIN:
+            pin = true;
+            break;
+         case OPT_RNG_THREAD_OFF:
+            rngThread = false;
+            break;
          case OPT_RXNS_ON:
             doRxns = true;
             break;
          case OPT_SHUFFLE_OFF:
             doShuffle = false;
             break;
+         case OPT_SIMD_OFF:
+            doSIMD = false;
+            break;
+         case OPT_SKIP_OFF:
+            doSkip = false;
+            break;
+         case OPT_SSA:
+            if( std::string( optarg ) == "direct" )
+            {
+               ssa = SSA_DIRECT;
+            }
+            else
+            {
+               if( std::string( optarg ) == "next-reaction" )
+               {
+                  ssa = SSA_NEXT_RXN;
+               }
+               else
+               {
+                  std::cerr << "options: --ssa must have value \"direct\" or \"next-reaction\"!" << std::endl;
+                  exit( EXIT_FAILURE );
+               }
+            }
+            break;
+         case OPT_TILED:
+            doTiled = true;
+            break;
+         case OPT_TUNE_FILE:
+            tunePath = optarg;
+            break;
+         case OPT_WELL_MIXED:
+            doWellMixed = true;
+            break;
          default:
             std::cerr << "Unknown option.  Try --help for a full list." << std::endl;
             exit( EXIT_FAILURE );
             break;
       }
    }
+
+   // The fused sweep is built from the byte-per-position
+   // kernels and cannot use the bitplane engine
+   if( doFused && doBitplanes )
+   {
+      std::cerr << "options: --fused and --bitplanes cannot be used together." << std::endl;
+      exit( EXIT_FAILURE );
+   }
+
+   // The kinetic Monte Carlo engine replaces both phases of
+   // the synchronous engines
+   if( doKMC && ( doFused || doBitplanes ) )
+   {
+      std::cerr << "options: --kmc cannot be used with --fused or --bitplanes." << std::endl;
+      exit( EXIT_FAILURE );
+   }
+
+   // The well-mixed stochastic simulation has no world to
+   // move atoms in, shuffle, or display
+   if( ssa != SSA_OFF )
+   {
+      if( doKMC || doFused || doBitplanes )
+      {
+         std::cerr << "options: --ssa cannot be used with --kmc, --fused or --bitplanes." << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      doShuffle = false;
+      doDiffusion = false;
+      gui = GUI_OFF;
+   }
+
+   // The well-mixed sampling of a shuffled world has no
+   // world either, and stands in for shuffling one
+   if( doWellMixed )
+   {
+      if( !doShuffle )
+      {
+         std::cerr << "options: --well-mixed can only be used with --shuffle." << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      if( doKMC || doFused || doBitplanes || ssa != SSA_OFF )
+      {
+         std::cerr << "options: --well-mixed cannot be used with --kmc, --fused, --bitplanes or --ssa." << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      doDiffusion = false;
+      gui = GUI_OFF;
+   }
+
+   // The lattice file holds the lattice of a world
+   if( latticePath != "" && ( ssa != SSA_OFF || doWellMixed ) )
+   {
+      std::cerr << "options: --lattice-file cannot be used with --ssa or --well-mixed." << std::endl;
+      exit( EXIT_FAILURE );
+   }
+
+   // The lean world keeps only the type at each position,
+   // moving atoms with the bitplane engine; there are no
+   // Atoms to keep statistics for, shuffle, or track
+   if( lean )
+   {
+      if( doKMC || doFused || doShuffle || ssa != SSA_OFF )
+      {
+         std::cerr << "options: --lean cannot be used with --kmc, --fused, --shuffle or --ssa." << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      doBitplanes = true;
+      doDiffusion = false;
+      gui = GUI_OFF;
+   }
+
+   // The tuner chooses between the engines of a world kept
+   // by Atoms; a tune file is of use only to it
+   if( tunePath != "" )
+      autotune = true;
+   if( autotune && ( doKMC || lean || ssa != SSA_OFF || doWellMixed ) )
+   {
+      std::cerr << "options: --autotune cannot be used with --kmc, --lean, --ssa or --well-mixed." << std::endl;
+      exit( EXIT_FAILURE );
+   }
 }
 
 
@@ -402,6 +662,26 @@ Options::printHelp()
    std::cout << "-f, --files         Specify the names of the four output files."             << std::endl;
    std::cout << "                      Default: config.out census.out diffusion.out rand.out" << std::endl;
 #endif
+   std::cout << "    --autotune      Time a few iterations of each engine, with and without"  << std::endl;
+   std::cout << "                      --tiled and the SIMD kernels, on the world of the run,"<< std::endl;
+   std::cout << "                      and run with the fastest, which is written to the"     << std::endl;
+   std::cout << "                      config file. Overrides --bitplanes, --fused, --tiled"  << std::endl;
+   std::cout << "                      and --simd-off."                                       << std::endl;
+   std::cout << "    --bitplanes     Move atoms using bitplanes, 64 positions per word, in"   << std::endl;
+   std::cout << "                      place of the byte-per-position lattice kernels."       << std::endl;
+   std::cout << "    --classic-build Place the atoms by shuffling every position, as older"   << std::endl;
+   std::cout << "                      versions did, so that a seed builds the same world."   << std::endl;
+   std::cout << "                      Slower to start; ignored with --lean. The build is"    << std::endl;
+   std::cout << "                      recorded in the config file, and a config file"       << std::endl;
+   std::cout << "                      without it is taken to be built this way."             << std::endl;
+   std::cout << "    --diffusion-off Do not keep the displacement and collision counts of"  << std::endl;
+   std::cout << "                      atoms; only the header of the diffusion file is"       << std::endl;
+   std::cout << "                      written."                                              << std::endl;
+   std::cout << "    --expected      Also write to the given file the census expected from" << std::endl;
+   std::cout << "                      integrating the mass-action rate equations of the"     << std::endl;
+   std::cout << "                      reactions, with the same rates as --ssa."              << std::endl;
+   std::cout << "    --fused         Move atoms and execute reactions in a single banded"   << std::endl;
+   std::cout << "                      pass over the world (experimental)."                   << std::endl;
 #if defined(HAVE_QT) & defined(HAVE_NCURSES)
    std::cout << "-g, --gui-off       Disable the Qt GUI or use the ncurses text-based GUI"    << std::endl;
    std::cout << "    --gui-ncurses     instead."                                              << std::endl;
@@ -418,11 +698,41 @@ Options::printHelp()
 #endif
    std::cout << "-h, --help          Display this information."                               << std::endl;
    std::cout << "-i, --iters         Number of iterations. Default: 1000000"                  << std::endl;
+   std::cout << "    --kmc           Use the event-driven kinetic Monte Carlo engine, which"  << std::endl;
+   std::cout << "                      moves each atom and executes each reaction at random"  << std::endl;
+   std::cout << "                      times rather than once per iteration. Faster only"     << std::endl;
+   std::cout << "                      when atoms are sparse; an iteration is one unit of"    << std::endl;
+   std::cout << "                      time. Atoms collide only with atoms already at their"  << std::endl;
+   std::cout << "                      destination, so diffusion, collisions and kinetics"    << std::endl;
+   std::cout << "                      differ from the other engines and are not comparable"  << std::endl;
+   std::cout << "                      with them."                                            << std::endl;
+   std::cout << "    --lattice-file  Keep the lattice in the given file, mapped into"         << std::endl;
+   std::cout << "                      memory behind a header describing it, so that other"   << std::endl;
+   std::cout << "                      programs can map it read-only while the simulation"    << std::endl;
+   std::cout << "                      runs. The layout is given in lattice-file.h."          << std::endl;
+   std::cout << "    --lean          Keep the world in about 2 bytes per position, for very"  << std::endl;
+   std::cout << "                      large worlds: only the element at each position is"    << std::endl;
+   std::cout << "                      stored, so atoms are not tracked and the diffusion"    << std::endl;
+   std::cout << "                      file has only its header. Implies --bitplanes. The"    << std::endl;
+   std::cout << "                      memory taken is printed at startup."                   << std::endl;
    std::cout << "-l, --load          Specify the name of a config file to load settings"      << std::endl;
    std::cout << "                      from. Any other options specified will override"       << std::endl;
    std::cout << "                      loaded options."                                       << std::endl;
+   std::cout << "    --numa          Keep the memory of the simulation on one NUMA node,"     << std::endl;
+   std::cout << "                      and the process on the CPUs of that node; under MPI"   << std::endl;
+   std::cout << "                      the ranks of a host are spread over its nodes."        << std::endl;
+   std::cout << "                      Without libnuma, memory is placed by first touch."     << std::endl;
+   std::cout << "    --pin           Pin the process to one CPU; under MPI the ranks of a"    << std::endl;
+   std::cout << "                      host are spread over its CPUs, neighboring slabs on"   << std::endl;
+   std::cout << "                      neighboring CPUs. The placement in effect is"          << std::endl;
+   std::cout << "                      reported with --verbose."                              << std::endl;
    std::cout << "-p, --progress-off  Disable simulation progress reporting (percent"          << std::endl;
    std::cout << "                      complete)."                                            << std::endl;
+   std::cout << "    --rng-thread-off Draw the random numbers only when they are needed,"     << std::endl;
+   std::cout << "                      rather than drawing those of the next iteration in"    << std::endl;
+   std::cout << "                      a second thread during this one, which is done when"   << std::endl;
+   std::cout << "                      a second CPU is available and the world is large"      << std::endl;
+   std::cout << "                      enough. Either way the same numbers are drawn."        << std::endl;
    std::cout << "-r, --rxns-off      Disable or enable the execution of chemical reactions."  << std::endl;
    std::cout << "    --rxns-on         Reactions are enabled by default."                     << std::endl;
    std::cout << "-s, --seed          Seed for the random number generator. Initialized using" << std::endl;
@@ -430,8 +740,27 @@ Options::printHelp()
    std::cout << "-S, --shuffle       Enable or disable shuffling of the positions of atoms"   << std::endl;
    std::cout << "    --shuffle-off     in the world each iteration. Shuffling is disabled by" << std::endl;
    std::cout << "                      default."                                              << std::endl;
+   std::cout << "    --simd-off      Disable the SIMD (AVX2) engine kernels and use the"      << std::endl;
+   std::cout << "                      equivalent scalar code instead."                       << std::endl;
+   std::cout << "    --skip-off      Test every position for a reaction even when all"       << std::endl;
+   std::cout << "                      reaction probabilities are small enough for the"      << std::endl;
+   std::cout << "                      positions that pass to be found by skipping ahead."   << std::endl;
+   std::cout << "    --ssa           Simulate the chemistry as well mixed, without a world," << std::endl;
+   std::cout << "                      using Gillespie's stochastic simulation algorithm."   << std::endl;
+   std::cout << "                      The method must be \"direct\" or \"next-reaction\"."  << std::endl;
+   std::cout << "                      Reaction probabilities are converted to rates for a"  << std::endl;
+   std::cout << "                      world of the given size."                             << std::endl;
+   std::cout << "    --tiled         Store the lattice in page-sized tiles rather than row"   << std::endl;
+   std::cout << "                      by row, which may be faster for very wide worlds."     << std::endl;
+   std::cout << "    --tune-file     With --autotune, which it implies, reuse the choice"     << std::endl;
+   std::cout << "                      made before for the same host and workload from the"   << std::endl;
+   std::cout << "                      given file, or add the new choice to it."              << std::endl;
    std::cout << "-v, --version       Display version information."                            << std::endl;
    std::cout << "-V, --verbose       Write to screen detailed information for debugging."     << std::endl;
+   std::cout << "    --well-mixed    With --shuffle, draw the reactions of each iteration"    << std::endl;
+   std::cout << "                      from the numbers of atoms of each element, with the"   << std::endl;
+   std::cout << "                      statistics of a shuffled world, rather than shuffling" << std::endl;
+   std::cout << "                      and scanning the world itself."                        << std::endl;
    std::cout << "-x, --width         Width of the world. Default: 250"                        << std::endl;
    std::cout << "-y, --height        Height of the world. Default: 250"                       << std::endl;
    std::cout << "-z, --sleep         Number of milliseconds to sleep between iterations."     << std::endl;
@@ -27,10 +27,28 @@ class Options
       int gui;
       bool doRxns;
       bool doShuffle;
+      bool doSIMD;
+      bool doSkip;
+      bool doFused;
+      bool doTiled;
+      bool doBitplanes;
+      bool doDiffusion;
+      bool doKMC;
+      bool lean;
+      bool classicBuild;
+      bool numa;
+      bool pin;
+      bool rngThread;
+      bool autotune;
+      int ssa;
+      bool doWellMixed;
       int sleep;
       bool verbose;
       bool progress;
       std::vector<std::string> filePaths;
+      std::string expectedPath;
+      std::string latticePath;
+      std::string tunePath;
 
       std::ifstream loadFile;
 
@@ -45,7 +63,10 @@ class Options
                   // all files for auto-enum)
          GUI_OFF,
          GUI_QT,
-         GUI_NCURSES
+         GUI_NCURSES,
+         SSA_OFF,
+         SSA_DIRECT,
+         SSA_NEXT_RXN
       };
 };
 
@@ -7,116 +7,231 @@
 
 
 // Constructor
-Plot::Plot( Options* initOptions, Sim* initSim, QWidget* parent )
+Series::Series()
+{
+   start = 0;
+   stride = 1;
+   nBuckets = 0;
+}
+
+
+// Add the value of the series after an iteration; the
+// iterations are appended in increasing order
+void
+Series::append( int iter, double value )
+{
+   if( nBuckets == 0 )
+      start = iter;
+
+   int bucket = ( iter - start ) / stride;
+   while( bucket >= MAX_BUCKETS )
+   {
+      merge();
+      bucket = ( iter - start ) / stride;
+   }
+
+   if( bucket >= nBuckets )
+   {
+      // Start a new bucket, and any skipped over
+      for( int i = nBuckets; i <= bucket; i++ )
+      {
+         low[i] = high[i] = value;
+         lowIter[i] = highIter[i] = iter;
+         setPoints( i );
+      }
+      nBuckets = bucket + 1;
+   }
+   else
+   {
+      // Widen the bucket to hold the value
+      if( value < low[ bucket ] )
+      {
+         low[ bucket ] = value;
+         lowIter[ bucket ] = iter;
+      }
+      if( value > high[ bucket ] )
+      {
+         high[ bucket ] = value;
+         highIter[ bucket ] = iter;
+      }
+      setPoints( bucket );
+   }
+}
+
+
+// Returns the number of points of the curve
+int
+Series::getLength()
+{
+   return 2 * nBuckets;
+}
+
+
+// Returns the x-coordinates of the points of the curve
+const double*
+Series::getX()
+{
+   return x;
+}
+
+
+// Returns the y-coordinates of the points of the curve
+const double*
+Series::getY()
+{
+   return y;
+}
+
+
+// Merge each pair of neighboring buckets, doubling the
+// stride
+void
+Series::merge()
+{
+   for( int i = 0; 2 * i < nBuckets; i++ )
+   {
+      int a = 2 * i;
+      int b = ( a + 1 < nBuckets ) ? a + 1 : a;
+      bool bLower = ( low[b] < low[a] );
+      bool bHigher = ( high[b] > high[a] );
+      low[i] = bLower ? low[b] : low[a];
+      lowIter[i] = bLower ? lowIter[b] : lowIter[a];
+      high[i] = bHigher ? high[b] : high[a];
+      highIter[i] = bHigher ? highIter[b] : highIter[a];
+   }
+   nBuckets = ( nBuckets + 1 ) / 2;
+   stride *= 2;
+
+   for( int i = 0; i < nBuckets; i++ )
+      setPoints( i );
+}
+
+
+// Set the two points of the curve for a bucket, its
+// extremes in the order they occurred
+void
+Series::setPoints( int bucket )
+{
+   bool lowFirst = ( lowIter[ bucket ] <= highIter[ bucket ] );
+   x[ 2 * bucket ]     = lowFirst ? lowIter[ bucket ] : highIter[ bucket ];
+   y[ 2 * bucket ]     = lowFirst ? low[ bucket ] : high[ bucket ];
+   x[ 2 * bucket + 1 ] = lowFirst ? highIter[ bucket ] : lowIter[ bucket ];
+   y[ 2 * bucket + 1 ] = lowFirst ? high[ bucket ] : low[ bucket ];
+}
+
+
+// Constructor
+Plot::Plot( Options* initOptions, Sim* initSim, Snapshot* initShown, QWidget* parent )
    : QwtPlot( parent )
 {
    // Copy constructor arguments
    o = initOptions;
    sim = initSim;
+   shown = initShown;
+   initialized = false;
+   lastPlotted = -1;
 
    // Set up the plot
    setTitle( "" );
    setAxisTitle( 0, "Density" );
    setAxisTitle( 2, "Time (iters)" );
+
+   // Set up the timer for redrawing updates that come
+   // too soon after the last redraw
+   replotTimer = new QTimer( this );
+   replotTimer->setSingleShot( true );
+   connect( replotTimer, SIGNAL( timeout() ), this, SLOT( redraw() ) );
 }
 
 
-// Update the data arrays and redraw the plot
+// Destructor; the curves draw straight from the series,
+// so they are detached and deleted before the series are
+Plot::~Plot()
+{
+   for( CurveMap::iterator i = curves.begin(); i != curves.end(); i++ )
+   {
+      i->second->detach();
+      delete i->second;
+   }
+   for( SeriesMap::iterator i = density.begin(); i != density.end(); i++ )
+      delete i->second;
+}
+
+
+// Add the iterations of the Snapshot shown that have not
+// been plotted yet to the series and redraw the plot
 void
 Plot::update()
 {
-   static bool initialized = false;
-
    if( !initialized )
    {
-      // Create and initialize the array of x-coordinate values
-      arrayLength = o->maxIters + 1;
-      iterData = new double [ arrayLength ];
-      iterData[ sim->getItersCompleted() ] = sim->getItersCompleted();
-
       // For each Element...
       for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
-      {  
+      {
          Element* ele = i->second;
          if( ele != sim->periodicTable[ "Solvent" ] )
          {
-            // Create and initialize the array of y-coordinate values for this
-            // Element
-            density[ ele->getName() ] = new double [ arrayLength ];
-            density[ ele->getName() ][ sim->getItersCompleted() ] = (double)ele->count / (double)(o->worldX * o->worldY);
+            // Create the series of densities of this Element
+            density[ ele->getName() ] = new Series();
 
-            // Create and initialize the curve for this Element
+            // Create the curve for this Element
             curves[ ele->getName() ] = new QwtPlotCurve( ele->getName().c_str() );
-            curves[ ele->getName() ]->setPen( QColor( ele->getColor().c_str() ) );
-            curves[ ele->getName() ]->setData( iterData, density[ ele->getName() ], sim->getItersCompleted() + 1 );
             curves[ ele->getName() ]->attach( this );
          }
       }
 
       initialized = true;
-   } else {
-      // Grow the data arrays if necessary
-      if( sim->getItersCompleted() + 1 > arrayLength )
-         growArrays();
+   }
 
-      // Update the array of x-coordinate values
-      iterData[ sim->getItersCompleted() ] = sim->getItersCompleted();
+   // For each iteration not yet plotted...
+   for( int row = 0; row < shown->getHistoryLength(); row++ )
+   {
+      int iter = shown->historyStart + row;
+      if( iter <= lastPlotted )
+         continue;
 
-      // For each Element...
+      // Append the density of each Element
       for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
       {
          Element* ele = i->second;
          if( ele != sim->periodicTable[ "Solvent" ] )
-         {
-            // Update the array of y-coordinate values for this Element
-            density[ ele->getName() ][ sim->getItersCompleted() ] = (double)ele->count / (double)(o->worldX * o->worldY);
-
-            // Update the curve for this Element
-            curves[ ele->getName() ]->setPen( QColor( ele->getColor().c_str() ) );
-            curves[ ele->getName() ]->setData( iterData, density[ ele->getName() ], sim->getItersCompleted() + 1 );
-         }
+            density[ ele->getName() ]->append( iter, (double)shown->getCount( row, ele->getIndex() ) / ( (double)o->worldX * (double)o->worldY ) );
       }
-   }
-
-   // Redraw the plot with the updated curves
-   replot();
-}
-
-
-// Increase the size of the data arrays
-void
-Plot::growArrays()
-{
-   int newArrayLength = arrayLength * 2;
 
-   // Grow the array of x-coordinate values
-   double* tempIterData = new double [ newArrayLength ];
-   for( int i = 0; i < arrayLength; i++ )
-   {
-      tempIterData[ i ] = iterData[ i ];
+      lastPlotted = iter;
    }
-   delete iterData;
-   iterData = tempIterData;
 
-   // For each Element...
+   // Update the curve for each Element; the curves draw
+   // straight from the series
    for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
    {
       Element* ele = i->second;
       if( ele != sim->periodicTable[ "Solvent" ] )
       {
-         // Grow the array of y-coordinate values for this Element
-         double* tempDensity = new double [ newArrayLength ];
-         for( int j = 0; j < arrayLength; j++ )
-         {
-            tempDensity[ j ] = density[ ele->getName() ][ j ];
-         }
-         delete density[ ele->getName() ];
-         density[ ele->getName() ] = tempDensity;
+         Series* series = density[ ele->getName() ];
+         curves[ ele->getName() ]->setPen( QColor( ele->getColor().c_str() ) );
+         curves[ ele->getName() ]->setRawData( series->getX(), series->getY(), series->getLength() );
       }
    }
 
-   arrayLength = newArrayLength;
+   // Redraw the plot with the updated curves, now or once
+   // enough time has passed since the last redraw
+   int interval = 1000 / MAX_REPLOT_RATE;
+   if( replotTimer->isActive() )
+      return;
+   if( lastReplot.isNull() || lastReplot.elapsed() >= interval )
+      redraw();
+   else
+      replotTimer->start( interval - lastReplot.elapsed() );
 }
 
-#endif /* HAVE_QT */
 
+// Redraw the plot with the curves as they are
+void
+Plot::redraw()
+{
+   lastReplot.start();
+   replot();
+}
+
+#endif /* HAVE_QT */
@@ -5,12 +5,52 @@
 #define PLOT_H 
 #ifdef HAVE_QT
 
+#include <QTime>
+#include <QTimer>
 #include <qwt_plot.h>
 #include <qwt_plot_curve.h>
 #include "options.h"
 #include "sim.h"
+#include "worker.h"
 
-typedef std::map<std::string,double*> DensityMap;
+// A time series kept in a fixed amount of memory: the
+// iterations are grouped into at most MAX_BUCKETS buckets of
+// stride iterations each, holding the least and greatest
+// value in the bucket, and when every bucket is in use the
+// neighboring buckets are merged and the stride doubles.
+// The curve is drawn through the two extremes of each
+// bucket in the order they occurred, which keeps every peak
+// and trough however long the series grows.
+class Series
+{
+   public:
+      // Constructor
+      Series();
+
+      void append( int iter, double value );
+      int getLength();
+      const double* getX();
+      const double* getY();
+
+   private:
+      static const int MAX_BUCKETS = 1024;
+      int start;
+      int stride;
+      int nBuckets;
+      double low[ MAX_BUCKETS ];
+      double high[ MAX_BUCKETS ];
+      int lowIter[ MAX_BUCKETS ];
+      int highIter[ MAX_BUCKETS ];
+
+      // The points of the curve, two for each bucket
+      double x[ 2 * MAX_BUCKETS ];
+      double y[ 2 * MAX_BUCKETS ];
+
+      void merge();
+      void setPoints( int bucket );
+};
+
+typedef std::map<std::string,Series*> SeriesMap;
 typedef std::map<std::string,QwtPlotCurve*> CurveMap;
 
 class Plot : public QwtPlot
@@ -19,22 +59,31 @@ class Plot : public QwtPlot
 
    public:
       // Constructor
-      Plot( Options* initOptions, Sim* initSim, QWidget* parent = 0 );
+      Plot( Options* initOptions, Sim* initSim, Snapshot* initShown, QWidget* parent = 0 );
+
+      // Destructor
+      ~Plot();
 
    public slots:
       void update();
+      void redraw();
 
    private:
       Options* o;
       Sim* sim;
-      int arrayLength;
-      double* iterData;
-      DensityMap density;
+      Snapshot* shown;
+      bool initialized;
+      int lastPlotted;
+      SeriesMap density;
       CurveMap curves;
 
-      void growArrays();
+      // The plot is redrawn at most MAX_REPLOT_RATE times a
+      // second; an update that comes sooner is drawn by
+      // replotTimer once the time is up
+      static const int MAX_REPLOT_RATE = 10;
+      QTime lastReplot;
+      QTimer* replotTimer;
 };
 
 #endif /* HAVE_QT */
 #endif /* PLOT_H */
-
@@ -0,0 +1,211 @@
+/* sim-autotune.cpp
+ */
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/time.h> // gettimeofday
+#include <unistd.h>   // gethostname
+#include "sim.h"
+
+
+// The engines that --autotune chooses between, as they are
+// named in config.out and the tune file
+static const int N_TUNE_ENGINES = 3;
+static const char* tuneEngineNames[ N_TUNE_ENGINES ] = { "bytes", "bitplanes", "fused" };
+
+
+// Returns the name of the engine chosen by the options
+static const char*
+tuneEngineName( Options* o )
+{
+   return tuneEngineNames[ o->doFused ? 2 : o->doBitplanes ? 1 : 0 ];
+}
+
+
+// Returns the wall-clock time in seconds
+static double
+wallSeconds()
+{
+   struct timeval now;
+   gettimeofday( &now, NULL );
+   return now.tv_sec + now.tv_usec * 1e-6;
+}
+
+
+// Try every combination of engine, lattice layout and SIMD
+// kernels on the world and chemistry of the run, timing a
+// few iterations of each, and keep the fastest.  The world
+// is built from the seed of the run for each and destroyed
+// again, so that the run starts exactly as it would with
+// the chosen options given.  With --tune-file, a choice
+// made before for the same host and workload is used
+// instead, and a new choice is added to the file.
+void
+Sim::autotune()
+{
+   std::string key = getTuneKey();
+   if( o->tunePath != "" && readTuneFile( key ) )
+   {
+      applyTuning();
+      if( o->verbose )
+         std::cout << "autotune: using " << tuneEngineName( o ) << ( o->doTiled ? " tiled" : "" ) << ( o->doSIMD ? "" : " simd-off" ) << " from " << o->tunePath << std::endl;
+      return;
+   }
+
+   // The SIMD kernels are tried both ways only if the
+   // processor supports them
+   bool simdChoices[2] = { true, false };
+   int nSIMDChoices = 1;
+#ifdef HAVE_AVX2
+   if( __builtin_cpu_supports( "avx2" ) )
+      nSIMDChoices = 2;
+#endif
+   if( nSIMDChoices == 1 )
+      simdChoices[0] = o->doSIMD;
+
+   double bestTime = -1;
+   int bestEngine = 0;
+   bool bestTiled = false;
+   bool bestSIMD = simdChoices[0];
+   for( int engine = 0; engine < N_TUNE_ENGINES; engine++ )
+   {
+      for( int tiled = 0; tiled < 2; tiled++ )
+      {
+         for( int simd = 0; simd < nSIMDChoices; simd++ )
+         {
+            o->doBitplanes = ( engine == 1 );
+            o->doFused = ( engine == 2 );
+            o->doTiled = tiled;
+            o->doSIMD = simdChoices[ simd ];
+            applyTuning();
+            buildWorld();
+
+            double time = 0;
+            for( int i = 0; i <= AUTOTUNE_ITERS; i++ )
+            {
+               double start = wallSeconds();
+               step();
+               if( i > 0 )
+                  time += wallSeconds() - start;
+            }
+            destroyWorld();
+
+            if( o->verbose )
+               std::cout << "autotune: " << tuneEngineName( o ) << ( o->doTiled ? " tiled" : "" ) << ( o->doSIMD ? "" : " simd-off" ) << " " << time / AUTOTUNE_ITERS * 1000 << " ms per iteration" << std::endl;
+            if( bestTime < 0 || time < bestTime )
+            {
+               bestTime = time;
+               bestEngine = engine;
+               bestTiled = tiled;
+               bestSIMD = o->doSIMD;
+            }
+         }
+      }
+   }
+
+   o->doBitplanes = ( bestEngine == 1 );
+   o->doFused = ( bestEngine == 2 );
+   o->doTiled = bestTiled;
+   o->doSIMD = bestSIMD;
+   applyTuning();
+   if( o->tunePath != "" )
+      writeTuneFile( key );
+}
+
+
+// Choose the engine variants for the tuned options
+void
+Sim::applyTuning()
+{
+#ifdef HAVE_AVX2
+   useAVX2 = o->doSIMD && __builtin_cpu_supports( "avx2" );
+#endif
+   selectEngine();
+}
+
+
+// Returns the host and the features of the workload that
+// a tuned choice is made for, separated by spaces
+std::string
+Sim::getTuneKey()
+{
+   char host[256];
+   if( gethostname( host, sizeof( host ) ) != 0 )
+      host[0] = '\0';
+   host[ sizeof( host ) - 1 ] = '\0';
+
+   std::ostringstream key;
+   key << ( host[0] != '\0' ? host : "unknown" ) << " " <<
+      o->worldX << " " <<
+      o->worldY << " " <<
+      elementsByIndex.size() - 1 << " " <<
+      rxnTable.size() << " " <<
+      ( o->doRxns ? "on" : "off" ) << " " <<
+      ( o->doShuffle ? "on" : "off" ) << " " <<
+      ( o->doDiffusion ? "on" : "off" );
+   return key.str();
+}
+
+
+// Look up the choice for the given key in the tune file,
+// whose lines hold a key followed by the engine and
+// whether the lattice is tiled and the SIMD kernels are
+// used; a later line for the same key takes precedence.
+// Returns true if a choice was found.
+bool
+Sim::readTuneFile( const std::string& key )
+{
+   std::ifstream tuneFile( o->tunePath.c_str() );
+   int keyFields = 0;
+   std::istringstream keyStream( key );
+   std::string field;
+   while( keyStream >> field )
+      keyFields++;
+
+   bool found = false;
+   std::string line;
+   while( std::getline( tuneFile, line ) )
+   {
+      if( line.empty() || line[0] == '#' )
+         continue;
+
+      std::istringstream lineStream( line );
+      std::string lineKey = "";
+      for( int i = 0; i < keyFields && lineStream >> field; i++ )
+         lineKey += ( i > 0 ? " " : "" ) + field;
+      std::string engine, tiled, simd;
+      if( lineKey != key || !( lineStream >> engine >> tiled >> simd ) )
+         continue;
+
+      for( int i = 0; i < N_TUNE_ENGINES; i++ )
+      {
+         if( engine == tuneEngineNames[ i ] )
+         {
+            o->doBitplanes = ( i == 1 );
+            o->doFused = ( i == 2 );
+            o->doTiled = ( tiled == "on" );
+            o->doSIMD = ( simd == "on" );
+            found = true;
+         }
+      }
+   }
+   return found;
+}
+
+
+// Add the choice made for the given key to the tune file
+void
+Sim::writeTuneFile( const std::string& key )
+{
+   std::ofstream tuneFile( o->tunePath.c_str(), std::ios::app );
+   if( !tuneFile )
+   {
+      std::cerr << "Warning: Unable to write the tune file " << o->tunePath << std::endl;
+      return;
+   }
+   tuneFile << key << " " <<
+      tuneEngineName( o ) << " " <<
+      ( o->doTiled ? "on" : "off" ) << " " <<
+      ( o->doSIMD ? "on" : "off" ) << std::endl;
+}
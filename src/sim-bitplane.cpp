@@ -0,0 +1,233 @@
+/* sim-bitplane.cpp
+ */
+
+#include <cstring> // memcpy, memset
+#include "sim.h"
+
+
+// Move Atoms in the lattice and handle collisions using
+// bitplanes, in which each bit of a 64-bit word stands for
+// one position in a row of the world.  The rules are the
+// same as in moveAtoms, but the claims are never counted:
+// since an atom can move only if its position and its
+// destination each carry exactly one claim, it is enough
+// to know which positions are claimed exactly once, and
+// that can be found 64 positions at a time with bitwise
+// operations on shifted copies of the planes.
+template<bool STATS>
+void
+Sim::moveAtomsBitplanes()
+{
+   // Record which positions hold atoms and the direction
+   // each atom wants to move
+   for( int y = 0; y < o->worldY; y++ )
+      packPlanesRow( y );
+
+   // Find the positions that are claimed exactly once
+   for( int y = 0; y < o->worldY; y++ )
+      findSinglyClaimedRow( y );
+
+   // Move or mark as collided every atom; as in moveAtoms,
+   // every atom is judged against the planes, which are
+   // left untouched while atoms are moved
+   for( int y = 0; y < o->worldY; y++ )
+      moveAtomsBitplanesRow<STATS>( y );
+}
+
+
+// The variant is chosen by selectEngine in sim-engine.cpp
+template void Sim::moveAtomsBitplanes<true>();
+template void Sim::moveAtomsBitplanes<false>();
+
+
+// Fill row y of occupancyPlane and dirPlanes from the
+// lattice and the random numbers
+void
+Sim::packPlanesRow( int y )
+{
+   uint64_t* occupied = occupancyPlane + y * planeWords;
+   uint64_t* dir[3];
+   for( int k = 0; k < 3; k++ )
+      dir[k] = dirPlanes + ( k * o->worldY + y ) * planeWords;
+
+   const uint64_t* rand = randNums + ( y & randRowMask ) * (int64_t)o->worldX;
+   for( int w = 0; w < planeWords; w++ )
+   {
+      uint64_t occupiedWord = 0;
+      uint64_t dirWord[3] = { 0, 0, 0 };
+      int x = w * 64;
+#ifdef HAVE_AVX2
+      // Pack 32 positions at a time; since tiles are a
+      // multiple of 32 positions wide, each group of 32
+      // lies within a single segment
+      if( useAVX2 )
+      {
+         for( ; x - w * 64 < 64 && x + 32 <= o->worldX; x += 32 )
+         {
+            uint32_t occupiedBits;
+            uint32_t dirBits[3];
+            packPlanesAVX2( x, y, &occupiedBits, dirBits );
+            occupiedWord |= (uint64_t)occupiedBits << ( x - w * 64 );
+            for( int k = 0; k < 3; k++ )
+               dirWord[k] |= (uint64_t)dirBits[k] << ( x - w * 64 );
+         }
+      }
+#endif
+      for( ; x - w * 64 < 64 && x < o->worldX; x++ )
+      {
+         uint64_t bit = (uint64_t)1 << ( x - w * 64 );
+         if( lattice[ rowOffset[y] + colOffset[x] ] != 0 )
+            occupiedWord |= bit;
+         for( int k = 0; k < 3; k++ )
+            if( rand[ x ] & ( 1 << k ) )
+               dirWord[k] |= bit;
+      }
+      occupied[w] = occupiedWord;
+      for( int k = 0; k < 3; k++ )
+         dir[k][w] = dirWord[k];
+   }
+}
+
+
+// Fill row y of singlyClaimedPlane: the positions claimed
+// by exactly one of the atom sitting there and the atoms
+// around it that want to move there
+void
+Sim::findSinglyClaimedRow( int y )
+{
+   uint64_t* once = planeRows[0];
+   uint64_t* twice = planeRows[1];
+   uint64_t* wants = planeRows[2];
+   uint64_t* claims = planeRows[3];
+
+   // One claim for an atom sitting in each position
+   std::memcpy( once, occupancyPlane + y * planeWords, planeWords * sizeof( uint64_t ) );
+   std::memset( twice, 0, planeWords * sizeof( uint64_t ) );
+
+   // One claim for each neighbor one step in the opposite
+   // direction that wants to move in this direction; once
+   // and twice count the claims up to two
+   for( int dir = 0; dir < 8; dir++ )
+   {
+      int sourceY = y - dirdy[dir];
+      if( sourceY < 0 )
+         sourceY += o->worldY;
+      else if( sourceY >= o->worldY )
+         sourceY -= o->worldY;
+      findMoveIntentsPlaneRow( sourceY, dir, wants );
+      shiftPlaneRow( wants, claims, dirdx[dir] );
+      for( int w = 0; w < planeWords; w++ )
+      {
+         twice[w] |= once[w] & claims[w];
+         once[w] |= claims[w];
+      }
+   }
+
+   uint64_t* singlyClaimed = singlyClaimedPlane + y * planeWords;
+   for( int w = 0; w < planeWords; w++ )
+      singlyClaimed[w] = once[w] & ~twice[w];
+}
+
+
+// Move or mark as collided every atom in row y
+template<bool STATS>
+void
+Sim::moveAtomsBitplanesRow( int y )
+{
+   uint64_t* movable = planeRows[2];
+   findMovableRow( y, movable );
+
+   const uint64_t* occupied = occupancyPlane + y * planeWords;
+   const uint64_t* dir[3];
+   for( int k = 0; k < 3; k++ )
+      dir[k] = dirPlanes + ( k * o->worldY + y ) * planeWords;
+
+   for( int w = 0; w < planeWords; w++ )
+   {
+      uint64_t atoms = occupied[w];
+      while( atoms != 0 )
+      {
+         int i = __builtin_ctzll( atoms );
+         int atomDir = ( ( dir[0][w] >> i ) & 1 ) | ( ( ( dir[1][w] >> i ) & 1 ) << 1 ) | ( ( ( dir[2][w] >> i ) & 1 ) << 2 );
+         moveAtom<STATS>( w * 64 + i, y, atomDir, ( movable[w] >> i ) & 1 );
+         atoms &= atoms - 1;
+      }
+   }
+}
+
+
+// Fill movable with the positions in row y holding atoms
+// that can move: those whose position and destination are
+// each claimed exactly once
+void
+Sim::findMovableRow( int y, uint64_t* movable )
+{
+   uint64_t* wants = planeRows[0];
+   uint64_t* destClear = planeRows[1];
+   const uint64_t* singlyClaimed = singlyClaimedPlane + y * planeWords;
+
+   std::memset( movable, 0, planeWords * sizeof( uint64_t ) );
+   for( int dir = 0; dir < 8; dir++ )
+   {
+      int destY = y + dirdy[dir];
+      if( destY < 0 )
+         destY += o->worldY;
+      else if( destY >= o->worldY )
+         destY -= o->worldY;
+      findMoveIntentsPlaneRow( y, dir, wants );
+      shiftPlaneRow( singlyClaimedPlane + destY * planeWords, destClear, -dirdx[dir] );
+      for( int w = 0; w < planeWords; w++ )
+         movable[w] |= wants[w] & singlyClaimed[w] & destClear[w];
+   }
+}
+
+
+// Fill wants with the positions in row y holding atoms
+// that want to move in direction dir
+void
+Sim::findMoveIntentsPlaneRow( int y, int dir, uint64_t* wants )
+{
+   const uint64_t* occupied = occupancyPlane + y * planeWords;
+   const uint64_t* bit0 = dirPlanes + ( 0 * o->worldY + y ) * planeWords;
+   const uint64_t* bit1 = dirPlanes + ( 1 * o->worldY + y ) * planeWords;
+   const uint64_t* bit2 = dirPlanes + ( 2 * o->worldY + y ) * planeWords;
+
+   // Each direction bit either must be set or must be clear
+   uint64_t flip0 = ( dir & 1 ) ? 0 : ~(uint64_t)0;
+   uint64_t flip1 = ( dir & 2 ) ? 0 : ~(uint64_t)0;
+   uint64_t flip2 = ( dir & 4 ) ? 0 : ~(uint64_t)0;
+   for( int w = 0; w < planeWords; w++ )
+      wants[w] = occupied[w] & ( bit0[w] ^ flip0 ) & ( bit1[w] ^ flip1 ) & ( bit2[w] ^ flip2 );
+}
+
+
+// Copy a row of a bitplane from src to dst shifted dx
+// positions to the right (dx is -1, 0 or 1), wrapping
+// around the edges of the world, so that the bit for x
+// in dst is the bit for x-dx in src
+void
+Sim::shiftPlaneRow( const uint64_t* src, uint64_t* dst, int dx )
+{
+   int n = planeWords;
+   int last = ( o->worldX - 1 ) % 64;
+
+   if( dx == 0 )
+   {
+      std::memcpy( dst, src, n * sizeof( uint64_t ) );
+   }
+   else if( dx == 1 )
+   {
+      uint64_t wrapped = ( src[ n - 1 ] >> last ) & 1;
+      for( int w = n - 1; w > 0; w-- )
+         dst[w] = ( src[w] << 1 ) | ( src[ w - 1 ] >> 63 );
+      dst[0] = ( src[0] << 1 ) | wrapped;
+      dst[ n - 1 ] &= lastWordMask;
+   }
+   else
+   {
+      uint64_t wrapped = src[0] & 1;
+      for( int w = 0; w < n - 1; w++ )
+         dst[w] = ( src[w] >> 1 ) | ( src[ w + 1 ] << 63 );
+      dst[ n - 1 ] = ( src[ n - 1 ] >> 1 ) | ( wrapped << last );
+   }
+}
@@ -1,18 +1,16 @@
 /* sim-engine.cpp
  */
 
-#define __USE_XOPEN2K   // Needed for posix_memalign on louder -- why?
-#include <cassert>
+#include <algorithm> // max, min, swap
+#include <climits> // INT_MAX, UINT_MAX
 #include <cmath>   // ceil
 #include <cstdarg> // variable arguments handling
-#include <cstdlib> // exit, posix_memalign
-#include <cstring> // memset
+#include <cstdlib> // exit
+#include <cstring> // memcpy, memset
 #include <fstream>
 #include <iostream>
 #include <SFMT/SFMT.h>
-#ifdef BLR_USEMAC
-#include <sys/malloc.h> // aligned memory retrieval on Mac
-#endif
+#include <unistd.h> // usleep
 #include "sim.h"
 
 
@@ -21,6 +19,15 @@ Sim::Sim( Options* initOptions )
 {
    // Copy constructor arguments
    o = initOptions;
+   randNums = NULL;
+   expectedOut = NULL;
+   latticeFile = NULL;
+   randNumsNext = NULL;
+   rngPipelined = false;
+   rngFillState = RNG_FILL_IDLE;
+#ifdef HAVE_PTHREADS
+   rngThreadStarted = false;
+#endif
 
    // Initialize the Sim
    initializeEngine();
@@ -60,6 +67,20 @@ Sim::initializeEngine()
       dirdy[6] = 0;  // W
       dirdy[7] = -1; // NW
 
+      rxndx = new int[5];
+      rxndx[0] = 0;  // First-order
+      rxndx[1] = 1;  // Second-order (E)
+      rxndx[2] = 1;  // Second-order (SE)
+      rxndx[3] = 0;  // Second-order (S)
+      rxndx[4] = -1; // Second-order (SW)
+
+      rxndy = new int[5];
+      rxndy[0] = 0;  // First-order
+      rxndy[1] = 0;  // Second-order (E)
+      rxndy[2] = 1;  // Second-order (SE)
+      rxndy[3] = 1;  // Second-order (S)
+      rxndy[4] = 1;  // Second-order (SW)
+
       // Create Solvent Element
       Element* tempEle;
       tempEle = new Element( "Solvent", '*', "white", 0.0 );
@@ -106,12 +127,70 @@ Sim::initializeEngine()
          extinctionTypes.push_back( ev(1,"B") );
       }
 
+      // Renumber the Elements in name order, after Solvent,
+      // so that the numbering does not depend on the order of
+      // the load file; config.out lists the Elements by name,
+      // and a run loaded from it must number them the same
+      // way for the samplers that go through them by index
+      int nextIndex = 1;
+      for( ElementMap::iterator i = periodicTable.begin(); i != periodicTable.end(); i++ )
+         i->second->setIndex( ( i->first == "Solvent" ) ? 0 : nextIndex++ );
+
+      // Index the Elements by their compact indices so that
+      // the lattice can be translated back into Elements
+      elementsByIndex.clear();
+      for( ElementMap::iterator i = periodicTable.begin(); i != periodicTable.end(); i++ )
+      {
+         if( i->second->getIndex() >= (int)elementsByIndex.size() )
+            elementsByIndex.resize( i->second->getIndex() + 1, (Element*)NULL );
+         elementsByIndex[ i->second->getIndex() ] = i->second;
+      }
+
+      // Translate the rxnTable into a form that can be
+      // searched quickly during executeRxns
+      compileRxnTable();
+
+      // Find the rates of the Reactions in a well-mixed world
+      // for the well-mixed simulation and the expected census
+      compileRateLaws();
+
+      // Use the AVX2 kernels if they were compiled in, are not
+      // disabled, and are supported by the processor
+#ifdef HAVE_AVX2
+      useAVX2 = o->doSIMD && __builtin_cpu_supports( "avx2" );
+#else
+      useAVX2 = false;
+#endif
+
+      // Split the world into slabs of rows, one for each rank,
+      // when running under MPI
+      mpiRank = 0;
+      mpiRanks = 1;
+      slabY = 0;
+      slabRows = o->worldY;
+      worldRows = o->worldY;
+#ifdef HAVE_MPI
+      mpiInit();
+#endif
+
+      // Pin the process and choose the node for its memory
+      // before any of the world is touched
+      placeProcess();
+
+      // Choose the engine variants for the features in use
+      selectEngine();
+
       // Open files after load file has been successfully read
       // in case the load file is also the config output file
       // and before RNG activity (since generateRandNums dumps
       // some numbers to file)
       openFiles();
 
+      // Choose the fastest engine for this host and workload
+      // before the world of the run is built
+      if( o->autotune )
+         autotune();
+
       buildWorld();
    }
 }
@@ -123,11 +202,33 @@ Sim::destroyWorld()
 {
    // Delete old world (if there is one)
    if( world != NULL )
-      for( int i = 0; i < o->worldX * o->worldY; i++ )
+      for( int64_t i = 0; i < (int64_t)o->worldX * o->worldY; i++ )
          delete world[ i ];
-   delete world;
-   delete claimed;
-   delete positions;
+
+   // Give back every buffer of the world at once; the arena
+   // keeps the memory for the next world, once the RNG
+   // thread is done with it
+   stopRandFill();
+   unmapLatticeFile();
+   arena.reset();
+   world = NULL;
+   worldSpare = NULL;
+   claimed = NULL;
+   lattice = NULL;
+   moveDirBits = NULL;
+   rowOffset = NULL;
+   colOffset = NULL;
+   positions = NULL;
+   occupancyPlane = NULL;
+   dirPlanes = NULL;
+   singlyClaimedPlane = NULL;
+   for( int i = 0; i < 4; i++ )
+      planeRows[i] = NULL;
+   kmcAtomIndex = NULL;
+   kmcClass = NULL;
+   kmcIndex = NULL;
+   randNums = NULL;
+   randNumsNext = NULL;
 }
 
 
@@ -135,26 +236,131 @@ Sim::destroyWorld()
 void
 Sim::buildWorld()
 {
-   // Set up the world
-   world = new Atom*[ o->worldX * o->worldY ];
-   claimed = new uint8_t[ o->worldX * o->worldY ];
-   positions = new unsigned int[ o->worldX * o->worldY ];
-   for( unsigned int i = 0; i < MAX_ELES_NOT_INCLUDING_SOLVENT; i++ )
-      maxPositions[ i ] = (o->worldX * o->worldY) / MAX_ELES_NOT_INCLUDING_SOLVENT;
-   for( unsigned int i = 0; i < (o->worldX * o->worldY) % MAX_ELES_NOT_INCLUDING_SOLVENT; i++ )
+   // Without MPI the one slab is the whole world, however it
+   // has been resized
+   if( mpiRanks == 1 )
+   {
+      slabRows = o->worldY;
+      worldRows = o->worldY;
+   }
+
+   // Divide the positions of the slab into one share for each
+   // position set; there are never fewer than
+   // MIN_POSITION_SETS shares, so the starting concentration
+   // of an Element is the same fraction of the world however
+   // few Elements there are
+   int nSets = positionSetReserved.size();
+   if( nSets < MIN_POSITION_SETS )
+      nSets = MIN_POSITION_SETS;
+   int64_t slabPositions = (int64_t)o->worldX * slabRows;
+   maxPositions.assign( nSets, slabPositions / nSets );
+   for( int i = 0; i < slabPositions % nSets; i++ )
       maxPositions[ i ]++;
-   for( unsigned int i = 0; i < MAX_ELES_NOT_INCLUDING_SOLVENT; i++ )
-      positionSetReserved[ i ] = false;
 
-   // Initialize the world array to NULL
-   for( int i = 0; i < o->worldX * o->worldY; i++ )
+   // A well-mixed simulation has no world
+   if( o->ssa != Options::SSA_OFF || o->doWellMixed )
    {
-      world[i] = NULL;
+      buildWellMixed();
+      return;
    }
 
-   // Initialize the random number generator
+   // The world array and the positions to shuffle are
+   // indexed by 32-bit ints, and the reaction instances of
+   // the kinetic Monte Carlo engine by ints; a lean world
+   // has neither
+   int64_t nPositions = (int64_t)o->worldX * o->worldY;
+   if( !o->lean && nPositions > UINT_MAX )
+   {
+      std::cerr << "Error: A world of more than " << UINT_MAX << " positions requires --lean" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   if( o->doKMC && 5 * nPositions > INT_MAX )
+   {
+      std::cerr << "Error: --kmc supports at most " << INT_MAX / 5 << " positions" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+
+   // Set up the world; a lean world keeps only the lattice
+   // and the bitplanes, and the positions are allocated only
+   // if they are shuffled
+   world = NULL;
+   worldSpare = NULL;
+   claimed = NULL;
+   moveDirBits = NULL;
+   positions = NULL;
+   setLayout();
+   if( o->latticePath != "" )
+      lattice = mapLatticeFile();
+   else
+      lattice = (uint8_t*)arena.allocate( latticeSize );
+   if( !o->lean )
+   {
+      world = (Atom**)arena.allocate( nPositions * sizeof( Atom* ) );
+      claimed = (uint8_t*)arena.allocate( latticeSize );
+      moveDirBits = (uint8_t*)arena.allocate( latticeSize );
+   }
+
+   // Set up the bitplanes if they will be used
+   planeWords = ( o->worldX + 63 ) / 64;
+   lastWordMask = ~(uint64_t)0 >> ( 63 - ( o->worldX - 1 ) % 64 );
+   occupancyPlane = NULL;
+   dirPlanes = NULL;
+   singlyClaimedPlane = NULL;
+   for( int i = 0; i < 4; i++ )
+      planeRows[i] = NULL;
+   if( o->doBitplanes )
+   {
+      occupancyPlane = (uint64_t*)arena.allocate( (int64_t)planeWords * o->worldY * sizeof( uint64_t ) );
+      dirPlanes = (uint64_t*)arena.allocate( 3 * (int64_t)planeWords * o->worldY * sizeof( uint64_t ) );
+      singlyClaimedPlane = (uint64_t*)arena.allocate( (int64_t)planeWords * o->worldY * sizeof( uint64_t ) );
+      for( int i = 0; i < 4; i++ )
+         planeRows[i] = (uint64_t*)arena.allocate( planeWords * sizeof( uint64_t ) );
+   }
+
+   // The kinetic Monte Carlo engine builds its own
+   // structures from the world when it first runs
+   kmcBuilt = false;
+   kmcAtomIndex = NULL;
+   kmcClass = NULL;
+   kmcIndex = NULL;
+
+   // Initialize the lattice to Solvent
+   std::memset( lattice, 0, latticeSize );
+   rxnClaimsEpoch = 0x10;
+
+   // Initialize the random number generator; a lean world
+   // draws the random numbers for a band of rows at a time,
+   // as few as make up the minimum that the RNG fills
+   randRowMask = -1;
+   if( o->lean )
+   {
+      int bandRows = 1;
+      while( (int64_t)bandRows * o->worldX < get_min_array_size64() && bandRows < o->worldY )
+         bandRows *= 2;
+      randRowMask = bandRows - 1;
+   }
    initRNG( o->seed );
 
+   // Initialize the world array to NULL
+   if( !o->lean )
+   {
+      for( int64_t i = 0; i < nPositions; i++ )
+      {
+         world[i] = NULL;
+      }
+      std::memset( moveDirBits, 0, latticeSize );
+      std::memset( claimed, 0, latticeSize );
+   }
+
+   // Place the atoms in a single pass over the world unless
+   // the placement of older versions is wanted
+   if( o->lean || !o->classicBuild )
+   {
+      placeAtoms();
+      endLatticeFileUpdate();
+      return;
+   }
+
    // Initialize the positions array with a random
    // ordering of integers ranging from 0 to
    // worldX*worldY-1
@@ -162,6 +368,7 @@ Sim::buildWorld()
 
    // Fill the array of random numbers
    generateRandNums();
+   randCursor = randNums_length_in_64_bit_ints;
 
    // Initialize the world with Atoms
    Atom* tempAtom;
@@ -170,15 +377,88 @@ Sim::buildWorld()
    {
       Element* thisEle = i->second;
       unsigned int nAtoms = (unsigned int)((double)thisEle->getStartConc() * (double)maxPositions[ positionSets[ thisEle->getName() ] ] + 0.5);
-      unsigned int setStart = 0;
+#ifdef HAVE_MPI
+      if( mpiRanks > 1 )
+         nAtoms = mpiShareOfAtoms( thisEle->getStartConc(), positionSets[ thisEle->getName() ] );
+#endif
+      int64_t setStart = 0;
       for( int i = 0; i < positionSets[ thisEle->getName() ]; i++ )
          setStart += maxPositions[ i ];
-      for( unsigned int j = setStart; j < setStart + nAtoms; j++ )
+      for( int64_t j = setStart; j < setStart + nAtoms; j++ )
       {
          x = positions[j] % o->worldX;
          y = positions[j] / o->worldX;
          tempAtom = new Atom( thisEle, x, y );
          world[ getWorldIndex(x,y) ] = tempAtom;
+         lattice[ getLatticeIndex(x,y) ] = thisEle->getIndex();
+      }
+   }
+   endLatticeFileUpdate();
+}
+
+
+// Place the atoms of the slab in a single pass, without
+// shuffling the positions: each position in turn is given
+// to an Element with probability equal to the share of the
+// remaining positions that the Element's remaining atoms
+// make up.  Every Element gets exactly as many atoms as its
+// position set calls for, the sets stay disjoint, and
+// every arrangement of the atoms is equally likely, as with
+// shufflePositions.  The Elements are taken in name order,
+// as config.out lists them, so that a run loaded from it
+// places the same atoms.  The Atoms, if the world keeps
+// them, come from their pool.
+void
+Sim::placeAtoms()
+{
+   ElementVector placed;
+   std::vector<int64_t> remaining;
+   int64_t remainingAtoms = 0;
+   for( ElementMap::iterator i = periodicTable.begin(); i != periodicTable.end(); i++ )
+   {
+      Element* thisEle = i->second;
+      if( thisEle == periodicTable[ "Solvent" ] )
+         continue;
+      thisEle->count = 0;
+      int64_t nAtoms = (int64_t)((double)thisEle->getStartConc() * (double)maxPositions[ positionSets[ thisEle->getName() ] ] + 0.5);
+#ifdef HAVE_MPI
+      if( mpiRanks > 1 )
+         nAtoms = mpiShareOfAtoms( thisEle->getStartConc(), positionSets[ thisEle->getName() ] );
+#endif
+      placed.push_back( thisEle );
+      remaining.push_back( nAtoms );
+      remainingAtoms += nAtoms;
+   }
+
+   // The position is drawn from the high bits of the product
+   // of a random number and the remaining positions, which is
+   // cheaper than the remainder and as uniform for any world
+   randCursor = randNums_length_in_64_bit_ints;
+   uint64_t remainingPositions = (uint64_t)o->worldX * slabRows;
+   for( int y = 0; y < slabRows && remainingAtoms > 0; y++ )
+   {
+      for( int x = 0; x < o->worldX; x++ )
+      {
+         int64_t rand = (int64_t)( ( (unsigned __int128)nextRand() * remainingPositions ) >> 64 );
+         remainingPositions--;
+         if( rand >= remainingAtoms )
+            continue;
+
+         int which = 0;
+         while( rand >= remaining[ which ] )
+         {
+            rand -= remaining[ which ];
+            which++;
+         }
+         remaining[ which ]--;
+         remainingAtoms--;
+
+         Element* thisEle = placed[ which ];
+         lattice[ rowOffset[y] + colOffset[x] ] = thisEle->getIndex();
+         if( world != NULL )
+            world[ x + (int64_t)y * o->worldX ] = new Atom( thisEle, x, y );
+         else
+            thisEle->count++;
       }
    }
 }
@@ -195,27 +475,23 @@ Sim::iterate()
    if( itersCompleted == 0 )
       initializeIO();
 
+#ifdef HAVE_MPI
+   // Every rank must run the same number of iterations
+   mpiAgreeOnEnd();
+#endif
+
    if( itersCompleted < o->maxIters )
    {
-      // Assign atoms new positions in the world
-      // randomly to simulate mixing
-      if( o->doShuffle )
-         shuffleWorld();
-
-      // Fill the array of random numbers with
-      // new values
-      generateRandNums();
-
-      // Move atoms and handle collisions
-      moveAtoms();
+      // Readers of the lattice file are told that the
+      // lattice is changing
+      beginLatticeFileUpdate();
 
-      // Scan the world, check for potential
-      // reactions, and execute some of them
-      if( o->doRxns )
-         executeRxns();
+      // Advance the world
+      step();
 
       // Increment the iteration counter
       itersCompleted++;
+      endLatticeFileUpdate();
 
       // Print out the progress of the simulation
       // at most once each second
@@ -224,6 +500,8 @@ Sim::iterate()
 
       // Take a census of the atoms in the world
       writeCensus();
+      if( expectedOut != NULL )
+         writeExpectedCensus();
 
       // Check to see if special conditions have
       // been met for ending the simulation early
@@ -233,7 +511,7 @@ Sim::iterate()
          ElementVector thisEleVector = *(i);
          for( unsigned int j = 0; j < thisEleVector.size(); j++ )
          {
-            allExtinct = allExtinct && (thisEleVector[j]->count == 0);
+            allExtinct = allExtinct && (censusCount( thisEleVector[j] ) == 0);
          }
          if( allExtinct )
          {
@@ -255,6 +533,20 @@ Sim::iterate()
 }
 
 
+// Returns the number of atoms of an Element in the whole
+// world as of the last census, which under MPI is summed
+// over every rank
+int64_t
+Sim::censusCount( Element* ele )
+{
+#ifdef HAVE_MPI
+   if( mpiRanks > 1 )
+      return mpiCounts[ ele->getIndex() ];
+#endif
+   return ele->count;
+}
+
+
 // Tell the simulation it is time to end
 // prematurely
 void
@@ -264,6 +556,36 @@ Sim::end()
 }
 
 
+// Advance the world by one iteration, leaving the
+// iteration counter, census and the rest of the
+// bookkeeping to iterate
+void
+Sim::step()
+{
+   // Assign atoms new positions in the world
+   // randomly to simulate mixing
+   if( o->doShuffle && !o->doWellMixed )
+      shuffleWorld();
+
+   // Fill the array of random numbers with
+   // new values; the kinetic Monte Carlo engine
+   // and the well-mixed simulations draw them as
+   // they need them, and a lean world a band of rows
+   // at a time
+   if( !o->doKMC && o->ssa == Options::SSA_OFF && !o->doWellMixed && !o->lean )
+      generateRandNums();
+
+   // Move atoms and handle collisions; the fused sweep
+   // executes reactions as well
+   (this->*moveEngine)();
+
+   // Scan the world, check for potential
+   // reactions, and execute some of them
+   if( rxnEngine != NULL )
+      (this->*rxnEngine)();
+}
+
+
 // Finish collecting data and clean up
 void
 Sim::cleanup()
@@ -281,6 +603,7 @@ Sim::cleanup()
       // data to file and clean up ncurses
       writeConfig();
       writeDiffusion();
+      syncLatticeFile();
       if( o->gui == Options::GUI_NCURSES )
          killncurses();
 
@@ -289,6 +612,7 @@ Sim::cleanup()
       delete out[ Options::FILE_CENSUS ];
       delete out[ Options::FILE_DIFFUSION ];
       delete out[ Options::FILE_RAND ];
+      delete expectedOut;
    }
 }
 
@@ -327,12 +651,120 @@ Sim::ev( int elementCount, ... )
 // Handles wrapping around the edges of the world
 // and translating two-dimensional coordinates
 // to a one-dimensional index for the world array
-int
+int64_t
 Sim::getWorldIndex( int x, int y )
 {
    int wrappedX = ( x + o->worldX ) % o->worldX;
    int wrappedY = ( y + o->worldY ) % o->worldY;
-   return ( wrappedX + wrappedY * o->worldX );
+   return ( wrappedX + (int64_t)wrappedY * o->worldX );
+}
+
+
+// Handles wrapping around the edges of the world
+// and translating two-dimensional coordinates
+// to a one-dimensional index for the lattice,
+// claimed and moveDirBits arrays
+int64_t
+Sim::getLatticeIndex( int x, int y )
+{
+   int wrappedX = ( x + o->worldX ) % o->worldX;
+   int wrappedY = ( y + o->worldY ) % o->worldY;
+   return ( rowOffset[ wrappedY ] + colOffset[ wrappedX ] );
+}
+
+
+// Returns the Atom at (x,y), or NULL if the
+// position holds Solvent
+Atom*
+Sim::getAtom( int x, int y )
+{
+   return world[ getWorldIndex( x, y ) ];
+}
+
+
+// Returns the Element of the Atom at (x,y), or
+// NULL if the position holds Solvent
+Element*
+Sim::getSpecies( int x, int y )
+{
+   int index = lattice[ getLatticeIndex( x, y ) ];
+   if( index == 0 )
+      return NULL;
+   return elementsByIndex[ index ];
+}
+
+
+// Copy the index of the Element at every position into
+// dest, which holds worldX * worldY bytes, position (x,y)
+// at x + y * worldX; a world without a lattice is copied
+// as Solvent
+void
+Sim::copyLattice( uint8_t* dest )
+{
+   if( lattice == NULL )
+   {
+      memset( dest, 0, (int64_t)o->worldX * o->worldY );
+      return;
+   }
+
+   // Each row is copied a segment at a time
+   for( int y = 0; y < o->worldY; y++ )
+      for( int x = 0; x < o->worldX; x += tileW )
+         memcpy( dest + x + (int64_t)y * o->worldX, lattice + rowOffset[y] + colOffset[x], std::min( tileW, o->worldX - x ) );
+}
+
+
+// Replace the contents of positions with the positions
+// x + y * worldX of the tracked atoms
+void
+Sim::findTracked( std::vector<int64_t>& positions )
+{
+   positions.clear();
+   if( world == NULL )
+      return;
+
+   int64_t nPositions = (int64_t)o->worldX * o->worldY;
+   for( int64_t i = 0; i < nPositions; i++ )
+      if( world[i] != NULL && world[i]->isTracked() )
+         positions.push_back( i );
+}
+
+
+// Choose the storage layout of the lattice, claimed
+// and moveDirBits arrays.  By default they are stored
+// row by row like the world array.  With --tiled they
+// are stored in tiles of TILE_W x TILE_H positions, each
+// filling a single page, so that the three rows touched
+// by the kernels around any position share a few pages
+// and cache lines rather than lying a whole world width
+// apart.  The world is padded out to a whole number of
+// tiles.  Either way, the index of (x,y) separates into
+// rowOffset[y] + colOffset[x], and the positions of a
+// row within one tile (a segment) are contiguous.
+void
+Sim::setLayout()
+{
+   if( o->doTiled )
+   {
+      tileW = std::min( (int)TILE_W, o->worldX );
+      tileH = std::min( (int)TILE_H, o->worldY );
+   }
+   else
+   {
+      tileW = o->worldX;
+      tileH = 1;
+   }
+   int tilesX = ( o->worldX + tileW - 1 ) / tileW;
+   int tilesY = ( o->worldY + tileH - 1 ) / tileH;
+   int tileSize = tileW * tileH;
+   latticeSize = (int64_t)tilesX * tilesY * tileSize;
+
+   rowOffset = (int64_t*)arena.allocate( o->worldY * sizeof( int64_t ) );
+   for( int y = 0; y < o->worldY; y++ )
+      rowOffset[ y ] = (int64_t)( y / tileH ) * tilesX * tileSize + ( y % tileH ) * tileW;
+   colOffset = (int*)arena.allocate( o->worldX * sizeof( int ) );
+   for( int x = 0; x < o->worldX; x++ )
+      colOffset[ x ] = ( x / tileW ) * tileSize + x % tileW;
 }
 
 
@@ -340,10 +772,14 @@ Sim::getWorldIndex( int x, int y )
 void
 Sim::initRNG( int initSeed )
 {
-   // Set the seed
-   init_gen_rand( (uint32_t)(initSeed) );
+   // Set the seed, once numbers drawn ahead from the old
+   // seed have been put aside; under MPI each rank draws its
+   // own stream, scrambling the rank into the seed so that
+   // the ranks of runs with consecutive seeds do not share
+   // streams
+   stopRandFill();
+   init_gen_rand( (uint32_t)(initSeed) ^ ( (uint32_t)(mpiRank) * 0x9E3779B9u ) );
 
-      free( randNums );
 
       // The array randNums will be treated by the
       // RNG as an array of 64-bit ints.  The length
@@ -351,14 +787,21 @@ Sim::initRNG( int initSeed )
       // multiple of 2 and the array must be at least
       // get_min_array_size64() 64-bit ints long.
       // With MEXP = 132049, get_min_array_size64() =
-      // 2*((MEXP/128)+1) = 2064.
-      int min_rand_nums_needed = o->worldX * o->worldY;
-      int min_bytes_needed = min_rand_nums_needed * sizeof( *randNums );
-      int min_64_bit_ints_needed = (int)ceil( min_bytes_needed / 8.0 );
+      // 2*((MEXP/128)+1) = 2064.  A well-mixed
+      // simulation has no positions to draw for and
+      // uses the minimum, and a lean world draws for
+      // one band of rows at a time.
+      int64_t min_rand_nums_needed = 0;
+      if( o->lean )
+         min_rand_nums_needed = (int64_t)( randRowMask + 1 ) * o->worldX;
+      else if( o->ssa == Options::SSA_OFF && !o->doWellMixed )
+         min_rand_nums_needed = (int64_t)o->worldX * o->worldY;
+      int64_t min_bytes_needed = min_rand_nums_needed * sizeof( *randNums );
+      int64_t min_64_bit_ints_needed = (int64_t)ceil( min_bytes_needed / 8.0 );
 
       // Make sure we have at least the minimum
       // length needed
-      randNums_length_in_64_bit_ints = std::max( min_64_bit_ints_needed, get_min_array_size64() );
+      randNums_length_in_64_bit_ints = std::max( min_64_bit_ints_needed, (int64_t)get_min_array_size64() );
 
       // Make sure we have a length (in 64-bit ints)
       // that is a multiple of 2.
@@ -367,23 +810,23 @@ Sim::initRNG( int initSeed )
          randNums_length_in_64_bit_ints++;
       }
 
-      int bytes_to_be_allocated = randNums_length_in_64_bit_ints * 8;
+      randNums = allocateRandNums( randNums_length_in_64_bit_ints );
 
-      int rc = 0;
-#ifdef BLR_USELINUX
-      rc = posix_memalign( (void**)&randNums, getpagesize(), bytes_to_be_allocated );
-#else
-#ifdef BLR_USEMAC
-      randNums = (uint64_t*)malloc( bytes_to_be_allocated );
-#else
-#ifdef BLR_USEWIN
-      randNums = (uint64_t*)malloc( bytes_to_be_allocated + 16 );
-      randNums += 16 - (long int)randNums % 16;
-#endif
-#endif
-#endif
-      assert( rc == 0 );
-      assert( randNums );
+      // Draw the numbers of each fill ahead in the RNG thread
+      // if it is worth it
+      rngPipelined = useRNGThread();
+      randNumsNext = NULL;
+      if( rngPipelined )
+         randNumsNext = allocateRandNums( randNums_length_in_64_bit_ints );
+}
+
+
+// Allocate an array of length 64-bit ints from the
+// arena, whose alignment is more than the RNG requires
+uint64_t*
+Sim::allocateRandNums( int64_t length )
+{
+   return (uint64_t*)arena.allocate( length * sizeof( uint64_t ) );
 }
 
 
@@ -392,9 +835,19 @@ Sim::initRNG( int initSeed )
 void
 Sim::generateRandNums()
 {
-   // fill_array64 fills randNums with 64-bit ints.
-   // See initRNG method for more information.
-   fill_array64( (uint64_t*)(randNums), randNums_length_in_64_bit_ints );
+   // With the RNG thread, take the numbers it has drawn
+   // ahead, which are the ones that would be drawn now, and
+   // have it draw the next
+   if( rngPipelined )
+   {
+      finishRandFill();
+      std::swap( randNums, randNumsNext );
+      startRandFill();
+   }
+   else
+   {
+      fillRandNums( randNums );
+   }
 
    // Dump a few random numbers to file if this
    // is the first time the array has been filled
@@ -411,6 +864,55 @@ Sim::generateRandNums()
 }
 
 
+// Fill an array the length of randNums with the next
+// random numbers
+void
+Sim::fillRandNums( uint64_t* array )
+{
+   // fill_array64 fills the array with 64-bit ints.
+   // See initRNG method for more information.  It takes
+   // the length as an int, so a longer array is filled in
+   // pieces, none of them shorter than the minimum, which
+   // continue the same sequence
+   int64_t filled = 0;
+   while( filled < randNums_length_in_64_bit_ints )
+   {
+      int64_t piece = randNums_length_in_64_bit_ints - filled;
+      if( piece > RAND_FILL_PIECE )
+      {
+         piece = RAND_FILL_PIECE;
+         if( randNums_length_in_64_bit_ints - filled - piece < get_min_array_size64() )
+            piece -= get_min_array_size64();
+      }
+      fill_array64( array + filled, (int)piece );
+      filled += piece;
+   }
+}
+
+
+// Returns the next of the random numbers, for the engines
+// that draw them one at a time, refilling the array when
+// they run out
+uint64_t
+Sim::nextRand()
+{
+   if( randCursor >= randNums_length_in_64_bit_ints )
+   {
+      generateRandNums();
+      randCursor = 0;
+   }
+   return randNums[ randCursor++ ];
+}
+
+
+// Returns a random number uniformly distributed in (0,1]
+double
+Sim::nextUniform()
+{
+   return (double)( ( nextRand() >> 11 ) + 1 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+
 // Fill the positions array with successive
 // integers ranging from 0 to worldX*worldY-1
 // and then shuffle these integers
@@ -422,14 +924,18 @@ Sim::shufflePositions()
    // Fill the array of random numbers
    generateRandNums();
 
+   if( positions == NULL )
+      positions = (unsigned int*)arena.allocate( (int64_t)o->worldX * o->worldY * sizeof( unsigned int ) );
+
    // Fill the positions array with successive integers
-   for( i = 0; i < (unsigned int)(o->worldX * o->worldY); i++ )
+   for( i = 0; i < (unsigned int)( (int64_t)o->worldX * o->worldY ); i++ )
    {
       positions[i] = i;
    }
 
-   // Shuffle the positions array (Fisher-Yates algorithm)
-   size = o->worldX * o->worldY;
+   // Shuffle the positions of the slab, which come first
+   // (Fisher-Yates algorithm)
+   size = (unsigned int)( (int64_t)o->worldX * slabRows );
    for( i = 0; i < size; i++ )
    {
       range = size - i;
@@ -441,31 +947,31 @@ Sim::shufflePositions()
 }
 
 
-// Reserves one of the available sets of lattice
-// positions to the passed Element
+// Reserves the first unreserved set of lattice positions
+// to the passed Element, adding a set if all are reserved
 void
 Sim::reservePositionSet( Element* ele )
 {
-   unsigned int i;
-   for( i = 0; i < MAX_ELES_NOT_INCLUDING_SOLVENT; i++ )
-   {
-      if( !positionSetReserved[ i ] )
-      {
-         positionSets[ ele->getName() ] = i;
-         positionSetReserved[ i ] = true;
-         return;
-      }
-   }
-   std::cerr << "reservePositionSet: limit of " << MAX_ELES_NOT_INCLUDING_SOLVENT << " Elements exceeded!" << std::endl;
-   exit( EXIT_FAILURE );
+   unsigned int i = 0;
+   while( i < positionSetReserved.size() && positionSetReserved[ i ] )
+      i++;
+   reservePositionSet( ele, i );
 }
 
 
-// Reserves one of the available sets of lattice
-// positions to the passed Element
+// Reserves the given set of lattice positions to the
+// passed Element
 void
 Sim::reservePositionSet( Element* ele, int set )
 {
+   if( set < 0 )
+   {
+      std::cerr << "reservePositionSet: set " << set << " is not valid!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   if( set >= (int)positionSetReserved.size() )
+      positionSetReserved.resize( set + 1, false );
+
    if( !positionSetReserved[ set ] )
    {
       positionSets[ ele->getName() ] = set;
@@ -487,11 +993,14 @@ Sim::shuffleWorld()
 {
    shufflePositions();
 
-   Atom** temp = new Atom*[ o->worldX * o->worldY ];
-   for( int i = 0; i < o->worldX * o->worldY; i++ )
+   if( worldSpare == NULL )
+      worldSpare = (Atom**)arena.allocate( (int64_t)o->worldX * o->worldY * sizeof( Atom* ) );
+   Atom** temp = worldSpare;
+   for( int64_t i = 0; i < (int64_t)o->worldX * o->worldY; i++ )
    {
       temp[i] = NULL;
    }
+   std::memset( lattice, 0, latticeSize );
 
    for( int x = 0; x < o->worldX; x++ )
    {
@@ -504,394 +1013,1007 @@ Sim::shuffleWorld()
             temp[ getWorldIndex(newX,newY) ] = world[ getWorldIndex(x,y) ];
             temp[ getWorldIndex(newX,newY) ]->x = newX;
             temp[ getWorldIndex(newX,newY) ]->y = newY;
+            lattice[ getLatticeIndex(newX,newY) ] = temp[ getWorldIndex(newX,newY) ]->getType()->getIndex();
          }
       }
    }
 
-   delete world;
+   worldSpare = world;
    world = temp;
 }
 
 
 // Move Atoms in the lattice and handle
 // collisions
+template<bool STATS>
 void
 Sim::moveAtoms()
 {
-   // Initially set all claimed flags to 0
-   std::memset( claimed, 0, o->worldX * o->worldY );
-   
-   // Increment a claimed flag wherever an atom exists and
-   // wherever an atom wants to move
-   for( int y = 0; y < o->worldY; y++ )
+   // Record the direction each atom wants to move
+   forEachSegment( &Sim::findMoveIntentsSegment );
+
+   // Count the claims staked on every position: one for an
+   // atom sitting there and one for each neighboring atom
+   // that wants to move there
+   forEachSegment( &Sim::countMoveClaimsSegment );
+
+   // An atom that can move (i.e., it has not experienced a
+   // collision) has a claimed value of exactly 1 in both its
+   // current position and the destination position for the
+   // atom.  An atom that cannot move has a claimed value
+   // greater than 1 in one or both of these positions.
+   //
+   // Because moveDirBits and claimed are left untouched while
+   // atoms are moved, every atom is judged against the state
+   // of the world at the start of the iteration, and an atom
+   // that moves into an area that has yet to be processed
+   // (e.g., SE) is never encountered a second time.
+   forEachSegment( &Sim::moveAtomsSegment<STATS> );
+}
+
+
+// Apply kernel to every segment of the world, visiting the
+// segments one tile at a time
+void
+Sim::forEachSegment( SegmentKernel kernel )
+{
+   for( int y0 = 0; y0 < o->worldY; y0 += tileH )
+      for( int x0 = 0; x0 < o->worldX; x0 += tileW )
+         for( int y = y0; y < std::min( y0 + tileH, o->worldY ); y++ )
+            (this->*kernel)( y, x0, std::min( x0 + tileW, o->worldX ) );
+}
+
+
+// Apply kernel to every segment of row y
+void
+Sim::forEachSegmentInRow( SegmentKernel kernel, int y )
+{
+   for( int x0 = 0; x0 < o->worldX; x0 += tileW )
+      (this->*kernel)( y, x0, std::min( x0 + tileW, o->worldX ) );
+}
+
+
+// Fill moveDirBits for the segment [x0, x1) of row y with
+// the direction each atom wants to move, stored as a
+// single set bit (bit n for direction n), or 0 where
+// there is no atom
+void
+Sim::findMoveIntentsSegment( int y, int x0, int x1 )
+{
+   int x = x0;
+#ifdef HAVE_AVX2
+   if( useAVX2 && x1 - x0 >= 32 )
    {
-      for( int x = 0; x < o->worldX; x++ )
+      // The last chunk is moved back to end at x1; since the
+      // kernel only stores, repeating positions is harmless
+      for( ; x < x1; x += 32 )
+         findMoveIntentsAVX2( std::min( x, x1 - 32 ), y );
+   }
+#endif
+   int64_t base = rowOffset[ y ] + colOffset[ x0 ] - x0;
+   const uint64_t* rand = randNums + ( y & randRowMask ) * (int64_t)o->worldX;
+   for( ; x < x1; x++ )
+   {
+      if( lattice[ base + x ] != 0 )
+         moveDirBits[ base + x ] = 1 << ( rand[ x ] & 0x7 );
+      else
+         moveDirBits[ base + x ] = 0;
+   }
+}
+
+
+// Fill claimed for the segment [x0, x1) of row y; interior
+// positions are handled 32 at a time by the AVX2 kernel if
+// it is available, and positions at the ends of the segment
+// (whose neighbors lie in other segments or wrap around the
+// edges of the world) are handled one at a time
+void
+Sim::countMoveClaimsSegment( int y, int x0, int x1 )
+{
+   int64_t base = rowOffset[ y ] + colOffset[ x0 ] - x0;
+   int x = x0;
+#ifdef HAVE_AVX2
+   if( useAVX2 && x1 - x0 >= 34 )
+   {
+      claimed[ base + x0 ] = countMoveClaims( x0, y );
+      for( x = x0 + 1; x < x1 - 1; x += 32 )
+         countMoveClaimsAVX2( std::min( x, x1 - 33 ), y );
+      x = x1 - 1;
+   }
+#endif
+   for( ; x < x1; x++ )
+      claimed[ base + x ] = countMoveClaims( x, y );
+}
+
+
+// Count the claims staked on position (x,y)
+uint8_t
+Sim::countMoveClaims( int x, int y )
+{
+   // Find the wrapped rows and columns adjacent to (x,y)
+   const uint8_t* row[3];
+   row[0] = moveDirBits + rowOffset[ y == 0 ? o->worldY - 1 : y - 1 ];
+   row[1] = moveDirBits + rowOffset[ y ];
+   row[2] = moveDirBits + rowOffset[ y == o->worldY - 1 ? 0 : y + 1 ];
+   int col[3];
+   col[0] = colOffset[ x == 0 ? o->worldX - 1 : x - 1 ];
+   col[1] = colOffset[ x ];
+   col[2] = colOffset[ x == o->worldX - 1 ? 0 : x + 1 ];
+
+   uint8_t count = ( row[1][ col[1] ] != 0 );
+   for( int dir = 0; dir < 8; dir++ )
+   {
+      // If the atom one step in the opposite direction
+      // wants to move in this direction, it claims (x,y)
+      if( row[ 1 - dirdy[dir] ][ col[ 1 - dirdx[dir] ] ] & ( 1 << dir ) )
+         count++;
+   }
+   return count;
+}
+
+
+// Move or mark as collided every atom in the segment
+// [x0, x1) of row y
+template<bool STATS>
+void
+Sim::moveAtomsSegment( int y, int x0, int x1 )
+{
+   int64_t base = rowOffset[ y ] + colOffset[ x0 ] - x0;
+   int x = x0;
+#ifdef HAVE_AVX2
+   if( useAVX2 && x1 - x0 >= 34 )
+   {
+      if( moveDirBits[ base + x0 ] != 0 )
+         moveAtom<STATS>( x0, y, __builtin_ctz( moveDirBits[ base + x0 ] ), canMove( x0, y ) );
+      for( x = x0 + 1; x < x1 - 1; x += 32 )
       {
-         if( world[ getWorldIndex(x,y) ] != NULL )
+         // The last chunk is moved back to end at x1-1, so
+         // skip the positions that have already been handled
+         int start = std::min( x, x1 - 33 );
+         uint32_t occupied;
+         uint32_t movable = canMoveAVX2( start, y, &occupied );
+         occupied &= ~0u << ( x - start );
+         while( occupied != 0 )
          {
-            int dx = dirdx[ randNums[ getWorldIndex(x,y) ] & 0x7 ];
-            int dy = dirdy[ randNums[ getWorldIndex(x,y) ] & 0x7 ];
-            claimed[ getWorldIndex(x,y) ]++;
-            claimed[ getWorldIndex(x+dx,y+dy) ]++;
+            int i = __builtin_ctz( occupied );
+            moveAtom<STATS>( start + i, y, __builtin_ctz( moveDirBits[ base + start + i ] ), ( movable >> i ) & 1 );
+            occupied &= occupied - 1;
          }
       }
+      x = x1 - 1;
+   }
+#endif
+   for( ; x < x1; x++ )
+   {
+      if( moveDirBits[ base + x ] != 0 )
+         moveAtom<STATS>( x, y, __builtin_ctz( moveDirBits[ base + x ] ), canMove( x, y ) );
    }
+}
 
-   // By this point, all atoms are guarenteed to have a positive
-   // claimed flag in their current position.  An atom that can
-   // move (i.e., it has not experienced a collision) has a claimed
-   // flag value of exactly 1 in both its current position and the
-   // destination position for the atom.  An atom that cannot move
-   // has a claimed flag value greater than 1 in one or both of
-   // these positions.
-   //
-   // Below, as the world is scanned, an atom will be marked as
-   // having been processed by setting its claimed flag value
-   // to 0.  This ensures that if the same atom is encountered
-   // again in the same pass (because, e.g., it moved SE into an
-   // area that had yet to be processed), its delta and collision
-   // variables will not be adjusted a second time in the same
-   // iteration.
 
-   for( int y = 0; y < o->worldY; y++ )
+// Returns true if the atom at (x,y) has not
+// experienced a collision
+bool
+Sim::canMove( int x, int y )
+{
+   int dir = __builtin_ctz( moveDirBits[ rowOffset[y] + colOffset[x] ] );
+   int destX = x + dirdx[dir];
+   int destY = y + dirdy[dir];
+   if( destX < 0 )
+      destX += o->worldX;
+   else if( destX >= o->worldX )
+      destX -= o->worldX;
+   if( destY < 0 )
+      destY += o->worldY;
+   else if( destY >= o->worldY )
+      destY -= o->worldY;
+   return claimed[ rowOffset[y] + colOffset[x] ] == 1 &&
+      claimed[ rowOffset[destY] + colOffset[destX] ] == 1;
+}
+
+
+// Update the atom at (x,y), moving it in its
+// intended direction dir if it can move; the
+// diffusion statistics of the atom are kept
+// only if STATS is true
+template<bool STATS>
+void
+Sim::moveAtom( int x, int y, int dir, bool canMove )
+{
+   int64_t site = rowOffset[y] + colOffset[x];
+   int dx = dirdx[ dir ];
+   int dy = dirdy[ dir ];
+   Atom* thisAtom = world[ x + (int64_t)y * o->worldX ];
+
+   if( STATS )
    {
-      for( int x = 0; x < o->worldX; x++ )
+      thisAtom->dx_ideal += dx;
+      thisAtom->dy_ideal += dy;
+   }
+
+   if( canMove )
+   // Move if there are no collisions
+   {
+      // Wrap around the edges of the world
+      int destX = x + dx;
+      int destY = y + dy;
+      if( destX < 0 )
+         destX += o->worldX;
+      else if( destX >= o->worldX )
+         destX -= o->worldX;
+      if( destY < 0 )
+         destY += o->worldY;
+      else if( destY >= o->worldY )
+         destY -= o->worldY;
+
+      if( STATS )
       {
-         if( world[ getWorldIndex(x,y) ] != NULL &&
-               claimed[ getWorldIndex(x,y) ] > 0 )
-         // If an atom is encountered that has not been processed yet
-         {
-            int dx = dirdx[ randNums[ getWorldIndex(x,y) ] & 0x7 ];
-            int dy = dirdy[ randNums[ getWorldIndex(x,y) ] & 0x7 ];
-            Atom* thisAtom = world[ getWorldIndex(x,y) ];
-
-            thisAtom->dx_ideal += dx;
-            thisAtom->dy_ideal += dy;
-
-            if( claimed[ getWorldIndex(x,y) ] == 1 && claimed[ getWorldIndex(x+dx,y+dy) ] == 1 )
-            // Move if there are no collisions
-            {
-               thisAtom->dx_actual += dx;
-               thisAtom->dy_actual += dy;
-
-               thisAtom->x = ( (x+dx) + o->worldX ) % o->worldX;
-               thisAtom->y = ( (y+dy) + o->worldY ) % o->worldY;
-
-               world[ getWorldIndex(x,y) ] = NULL;
-               world[ getWorldIndex(x+dx,y+dy) ] = thisAtom;
-
-               // Mark the moved atom as processed
-               claimed[ getWorldIndex(x+dx,y+dy) ] = 0;
-            }
-            else
-            // Else increment collisions
-            {
-               thisAtom->collisions++;
-
-               // Mark the unmoved atom as processed
-               claimed[ getWorldIndex(x,y) ] = 0;
-            }
-         }
+         thisAtom->dx_actual += dx;
+         thisAtom->dy_actual += dy;
+         thisAtom->x = destX;
+         thisAtom->y = destY;
       }
+
+      int64_t dest = rowOffset[ destY ] + colOffset[ destX ];
+      world[ x + (int64_t)y * o->worldX ] = NULL;
+      world[ destX + (int64_t)destY * o->worldX ] = thisAtom;
+      lattice[ dest ] = lattice[ site ];
+      lattice[ site ] = 0;
+   }
+   else
+   // Else increment collisions
+   {
+      if( STATS )
+         thisAtom->collisions++;
    }
 }
 
 
-// Scan the world, check for potential
-// reactions, and execute some of them
+// moveAtom is shared with the bitplane engine
+template void Sim::moveAtom<true>( int x, int y, int dir, bool canMove );
+template void Sim::moveAtom<false>( int x, int y, int dir, bool canMove );
+
+
+// Translate the rxnTable into dense lookup tables.  An
+// ordered pair of Element indices (a, b) is mapped by
+// rxnPairs[ a * ( rxnIndices + 1 ) + b ] to a compact pair
+// number, where b == rxnIndices stands for first-order
+// reactions and pair 0 has no reactions.  Each pair has
+// rxnPairChannels[ pair ] channels, starting at entry
+// rxnPairEntries[ pair ] of rxnThresholds and rxnChoices
+// and holding its Reactions in the order of the rxnTable,
+// and an attempt picks one channel of its pair uniformly.
+// Each entry stores the integer threshold below which
+// (rand >> 3) must fall for the Reaction to occur, and the
+// Reaction itself, or 0 and NULL for an empty channel.
 void
-Sim::executeRxns()
+Sim::compileRxnTable()
 {
-   Element* solventEle = periodicTable[ "Solvent" ];
-   Atom* thisAtom;
-   int neighborX, neighborY;
-   Atom* neighborAtom;
-
-   // Initially set all claimed flags to 0
-   std::memset( claimed, 0, o->worldX * o->worldY );
+   int nIndices = 0;
+   for( unsigned int i = 0; i < elementsByIndex.size(); i++ )
+      if( elementsByIndex[ i ] != NULL )
+         nIndices = i + 1;
+
+   // Group the Reactions by their unordered pairs of
+   // reactants
+   typedef std::pair<int,int> IndexPair;
+   std::map<IndexPair,std::vector<Reaction*> > groups;
+   for( ReactionMap::iterator i = rxnTable.begin(); i != rxnTable.end(); i++ )
+   {
+      ElementVector reactants = i->second->getReactants();
+      int a = reactants[0]->getIndex();
+      int b = ( reactants.size() > 1 ) ? reactants[1]->getIndex() : nIndices;
+      groups[ IndexPair( std::min( a, b ), std::max( a, b ) ) ].push_back( i->second );
+   }
 
-   // Increment a claimed flag wherever an atom that wants
-   // to react exists and wherever its reactive neighbor exists
-   for( int y = 0; y < o->worldY; y++ )
+   // Number the pairs that have Reactions; the table is
+   // padded by one entry so that the AVX2 kernel can gather
+   // it 32 bits at a time
+   int nEntries = nIndices * ( nIndices + 1 );
+   rxnPairs = new uint16_t[ nEntries + 1 ];
+   rxnPairs[ nEntries ] = 0;
+   std::vector<std::vector<Reaction*>*> pairGroups( 1, (std::vector<Reaction*>*)NULL );
+   std::map<IndexPair,int> pairNumbers;
+   for( int a = 0; a < nIndices; a++ )
    {
-      for( int x = 0; x < o->worldX; x++ )
+      for( int b = 0; b <= nIndices; b++ )
       {
-         if( world[ getWorldIndex(x,y) ] != NULL )
-         // If an atom is encountered
+         IndexPair pair( std::min( a, b ), std::max( a, b ) );
+         rxnPairs[ a * ( nIndices + 1 ) + b ] = 0;
+         if( groups.count( pair ) == 0 )
+            continue;
+         if( pairNumbers.count( pair ) == 0 )
          {
-            thisAtom = world[ getWorldIndex(x,y) ];
-         }
-         else
-         // Else solvent is encountered
-         {
-            thisAtom = new Atom( solventEle, x, y );
+            pairNumbers[ pair ] = pairGroups.size();
+            pairGroups.push_back( &groups[ pair ] );
          }
+         rxnPairs[ a * ( nIndices + 1 ) + b ] = pairNumbers[ pair ];
+      }
+   }
+   if( pairGroups.size() > 0xFFFF )
+   {
+      std::cerr << "compileRxnTable: limit of " << 0xFFFF - 1 << " pairs of reactants exceeded!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
 
-         // Determine which neighbor to attempt to react with, if any
-         switch( (randNums[ getWorldIndex(x,y) ] >> 3) % 5 )
-         {
-            case 0:  // First-order
-               neighborX = x+0;
-               neighborY = y+0;
-               break;
-            case 1:  // Second-order (E)
-               neighborX = x+1;
-               neighborY = y+0;
-               break;
-            case 2:  // Second-order (SE)
-               neighborX = x+1;
-               neighborY = y+1;
-               break;
-            case 3:  // Second-order (S)
-               neighborX = x+0;
-               neighborY = y+1;
-               break;
-            case 4:  // Second-order (SW)
-               neighborX = x-1;
-               neighborY = y+1;
-               break;
-            default:
-               assert( 0 );
-               break;
-         }
-         if( neighborX == x && neighborY == y )
-         {
-            neighborAtom = NULL;
-         }
-         else
-         {
-            if( world[ getWorldIndex(neighborX,neighborY) ] != NULL )
-            {
-               neighborAtom = world[ getWorldIndex(neighborX,neighborY) ];
-            }
-            else
-            {
-               neighborAtom = new Atom( solventEle, neighborX, neighborY );
-            }
-         }
+   // Each pair has a channel for each of its Reactions, and
+   // no fewer than MIN_RXN_CHANNELS, so that the Reactions of
+   // one pair do not change the rates of any other; a
+   // multiple of 5 is avoided since the channel and the
+   // neighbor of an attempt are both drawn from one random
+   // number, and would always coincide
+   int nPairs = pairGroups.size();
+   int nChannels = 0;
+   int nRxnEntries = 0;
+   rxnPairChannels = new int[ nPairs ];
+   rxnPairEntries = new int[ nPairs ];
+   for( int pair = 0; pair < nPairs; pair++ )
+   {
+      int channels = ( pair == 0 ) ? 0 : pairGroups[ pair ]->size();
+      if( channels < MIN_RXN_CHANNELS )
+         channels = MIN_RXN_CHANNELS;
+      while( channels % 5 == 0 )
+         channels++;
+      rxnPairChannels[ pair ] = channels;
+      rxnPairEntries[ pair ] = nRxnEntries;
+      nRxnEntries += channels;
+      nChannels = std::max( nChannels, channels );
+   }
 
-         // Determine the appropriate Reaction
-         Reaction* thisRxn;
-         std::pair<ReactionMap::iterator,ReactionMap::iterator> range;
-         if( neighborAtom == NULL )
-         // If the reaction is first-order
-            range = rxnTable.equal_range( thisAtom->getType()->getKey() );
-         else
-         // Else the reaction is second-order
-            range = rxnTable.equal_range( thisAtom->getType()->getKey() *
-                                      neighborAtom->getType()->getKey() );
-         // Find the n'th Reaction with the matching set of
-         // reactants, where n is a random number between 0 and
-         // MAX_RXNS_PER_SET_OF_REACTANTS
-         ReactionMap::iterator i = range.first;
-         for( unsigned int j = 0; j < (randNums[ getWorldIndex(x,y) ] >> 3) % MAX_RXNS_PER_SET_OF_REACTANTS; j++ )
+   // Channel n of a pair holds the n'th Reaction of its
+   // group, if there is one
+   rxnThresholds = new uint64_t[ nRxnEntries ];
+   rxnChoices = new Reaction*[ nRxnEntries ];
+   for( int pair = 0; pair < nPairs; pair++ )
+   {
+      for( int channel = 0; channel < rxnPairChannels[ pair ]; channel++ )
+      {
+         int entry = rxnPairEntries[ pair ] + channel;
+         if( pair != 0 && channel < (int)pairGroups[ pair ]->size() )
          {
-            if( i != range.second )
-               i++;
-            else
-               break;
+            rxnChoices[ entry ] = (*pairGroups[ pair ])[ channel ];
+            rxnThresholds[ entry ] = probThreshold( rxnChoices[ entry ]->getProb() );
          }
-         if( i != range.second )
-            thisRxn = i->second;
          else
-            thisRxn = NULL;
-
-         // Perform the reaction
-         if( thisRxn != NULL &&
-             (double)(randNums[ getWorldIndex(x,y) ] >> 3) /
-             (double)((uint64_t)1 << (8 * sizeof(*randNums) - 3))
-               < thisRxn->getProb() )
-         // If the reactant have enough energy
          {
-            if( neighborAtom == NULL )
-            // If the reaction is first-order
-            {
-               // Stake the claim
-               claimed[ getWorldIndex(x,y) ]++;
-            }
-            else
-            // Else the reaction is second-order
-            {
-               // Stake the claim
-               claimed[ getWorldIndex(x,y) ]++;
-               claimed[ getWorldIndex(neighborX,neighborY) ]++;
-            }
+            rxnChoices[ entry ] = NULL;
+            rxnThresholds[ entry ] = 0;
          }
+      }
+   }
 
-         // Delete any temporary solvent atoms
-         if( world[ getWorldIndex(x,y) ] == NULL )
-         {
-            delete thisAtom;
-            thisAtom = NULL;
-         }
-         if( world[ getWorldIndex(neighborX,neighborY) ] == NULL )
+#ifdef HAVE_COMPILED_CHEMISTRY
+   // A simulator specialised for a chemistry uses the
+   // compiled copy of the tables, so it can run only that
+   // chemistry
+   bool matches = ( (int)periodicTable.size() == COMPILED_ELEMENTS && nIndices == COMPILED_ELEMENTS &&
+                    nChannels == COMPILED_CHANNELS && nPairs == COMPILED_PAIRS && nRxnEntries == COMPILED_RXN_ENTRIES );
+   for( int a = 0; matches && a < nIndices; a++ )
+      matches = ( elementsByIndex[ a ] != NULL && elementsByIndex[ a ]->getName() == compiledElementNames[ a ] );
+   for( int entry = 0; matches && entry < nEntries; entry++ )
+      matches = ( rxnPairs[ entry ] == compiledRxnPairs[ entry ] );
+   for( int pair = 0; matches && pair < nPairs; pair++ )
+      matches = ( rxnPairChannels[ pair ] == compiledRxnPairChannels[ pair ] && rxnPairEntries[ pair ] == compiledRxnPairEntries[ pair ] );
+   for( int entry = 0; matches && entry < nRxnEntries; entry++ )
+      matches = ( rxnThresholds[ entry ] == compiledRxnThresholds[ entry ] );
+   if( !matches )
+   {
+      std::cerr << "compileRxnTable: this simulator was compiled for the chemistry in " <<
+         COMPILED_CHEMISTRY << " and cannot run any other!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+#else
+   rxnIndices = nIndices;
+   rxnChannels = nChannels;
+#endif
+
+   // Find the smallest power of 2 that no reaction
+   // probability exceeds; if it is small enough, nearly
+   // every attempt fails, and it is cheaper to skip ahead
+   // to the few positions that pass.  A chemistry whose
+   // reactions can never occur is left to the usual scan
+   const uint64_t scale = (uint64_t)1 << (8 * sizeof(*randNums) - 3);
+   uint64_t largest = 0;
+   for( int entry = 0; entry < nRxnEntries; entry++ )
+      largest = std::max( largest, rxnThresholds[ entry ] );
+   int shift = 0;
+   while( shift < 61 && largest <= ( scale >> ( shift + 1 ) ) )
+      shift++;
+   rxnSkipShift = 0;
+   if( o->doSkip && largest > 0 && shift >= MIN_RXN_SKIP_SHIFT )
+   {
+      rxnSkipShift = shift;
+      rxnSkipLogScale = 1.0 / log1p( -ldexp( 1.0, -shift ) );
+   }
+}
+
+
+// Returns the number of channels of the pair of reactants
+// of a Reaction, among which an attempt on the pair picks
+int
+Sim::rxnChannelsOf( Reaction* rxn )
+{
+   ElementVector reactants = rxn->getReactants();
+   int a = reactants[0]->getIndex();
+   int b = ( reactants.size() > 1 ) ? reactants[1]->getIndex() : rxnIndices;
+   return rxnPairChannels[ rxnPairs[ a * ( rxnIndices + 1 ) + b ] ];
+}
+
+
+// Returns the smallest integer u such that the reaction
+// test (double)u / 2^61 < prob fails, so that the test is
+// equivalent to the exact integer comparison u < threshold
+uint64_t
+Sim::probThreshold( double prob )
+{
+   const uint64_t scale = (uint64_t)1 << (8 * sizeof(*randNums) - 3);
+   uint64_t lo = 0;
+   uint64_t hi = scale;
+   while( lo < hi )
+   {
+      uint64_t mid = lo + ( hi - lo ) / 2;
+      if( (double)mid / (double)scale < prob )
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+
+// Scan the world, check for potential
+// reactions, and execute some of them
+template<bool TRACKING, bool SECOND_ORDER>
+void
+Sim::executeRxns()
+{
+   // Find every position whose attempted reaction passes
+   // the probability test
+   rxnAttempts.clear();
+   if( rxnSkipShift > 0 )
+   {
+      for( int y = 0; y < o->worldY; y++ )
+         findRxnAttemptsSkipRow<SECOND_ORDER>( y );
+   }
+   else
+   {
+      forEachSegment( &Sim::findRxnAttemptsSegment<SECOND_ORDER> );
+   }
+
+   // Increment a claimed flag wherever an atom that wants
+   // to react exists and wherever its reactive neighbor
+   // exists; a first-order reaction claims only its own
+   // position, so without second-order reactions no two
+   // attempts can compete and there is nothing to claim
+   if( SECOND_ORDER )
+   {
+      nextRxnClaimsEpoch();
+      claimRxnAttempts( 0, rxnAttempts.size() );
+   }
+
+   // An atom can react (i.e., it and its reacting neighbor
+   // are trying to participate in exactly 1 reaction) if
+   // it has exactly 1 reaction claim in both its position
+   // and the position of the neighboring reactive atom.  Since
+   // no position can take part in two reactions, the order in
+   // which reactions are executed does not matter.
+   resolveRxnAttempts<TRACKING,SECOND_ORDER>( 0, rxnAttempts.size() );
+}
+
+
+// Stake the claims of the reaction attempts [begin, end).
+// Rather than clearing claimed first, each iteration's
+// reaction claims are tagged with a new epoch: a position
+// holds rxnClaimsEpoch plus its number of claims (at most
+// 5) in the low 3 bits, and anything else, such as a move
+// claim count (at most 9) or a claim from an earlier
+// iteration, counts as no reaction claims.
+void
+Sim::claimRxnAttempts( unsigned int begin, unsigned int end )
+{
+   for( unsigned int i = begin; i < end; i++ )
+   {
+      claimRxnPosition( rxnAttempts[i].site );
+      if( rxnAttempts[i].slot != 0 )
+         claimRxnPosition( rxnAttempts[i].partner );
+   }
+}
+
+
+// Stake one reaction claim on the position at index i
+// of the lattice
+inline void
+Sim::claimRxnPosition( int64_t i )
+{
+   if( ( claimed[ i ] & ~0x7 ) != rxnClaimsEpoch )
+      claimed[ i ] = rxnClaimsEpoch;
+   claimed[ i ]++;
+}
+
+
+// Start a new epoch of reaction claims; when the epochs
+// run out, claimed is cleared and they start over
+void
+Sim::nextRxnClaimsEpoch()
+{
+   if( rxnClaimsEpoch == 0xF8 )
+   {
+      std::memset( claimed, 0, latticeSize );
+      rxnClaimsEpoch = 0x10;
+   }
+   else
+   {
+      rxnClaimsEpoch += 0x8;
+   }
+}
+
+
+// Execute those of the reaction attempts [begin, end)
+// that are uncontested
+template<bool TRACKING, bool SECOND_ORDER>
+void
+Sim::resolveRxnAttempts( unsigned int begin, unsigned int end )
+{
+   for( unsigned int i = begin; i < end; i++ )
+   {
+      if( !SECOND_ORDER ||
+          ( claimed[ rxnAttempts[i].site ] == rxnClaimsEpoch + 1 &&
+            claimed[ rxnAttempts[i].partner ] == rxnClaimsEpoch + 1 ) )
+         executeRxn<TRACKING>( rxnAttempts[i] );
+   }
+}
+
+
+// Find the reactions attempted in the segment [x0, x1) of
+// row y that pass the probability test; interior positions
+// are screened 8 at a time by the AVX2 kernel if it is
+// available, and only the positions that pass are examined
+// individually
+template<bool SECOND_ORDER>
+void
+Sim::findRxnAttemptsSegment( int y, int x0, int x1 )
+{
+   int x = x0;
+#ifdef HAVE_AVX2
+   if( useAVX2 && x1 - x0 >= 10 && rxnChannels == 2 )
+   {
+      findRxnAttempt<SECOND_ORDER>( x0, y );
+      for( x = x0 + 1; x < x1 - 1; x += 8 )
+      {
+         // The last chunk is moved back to end at x1-1, so
+         // skip the positions that have already been handled
+         int start = std::min( x, x1 - 9 );
+         uint32_t passed = findRxnAttemptsAVX2( start, y ) & ( ~0u << ( x - start ) );
+         while( passed != 0 )
          {
-            delete neighborAtom;
-            neighborAtom = NULL;
+            findRxnAttempt<SECOND_ORDER>( start + __builtin_ctz( passed ), y );
+            passed &= passed - 1;
          }
       }
+      x = x1 - 1;
    }
+#endif
+   for( ; x < x1; x++ )
+      findRxnAttempt<SECOND_ORDER>( x, y );
+}
 
-   // By this point, all atoms that are trying to react are
-   // guarenteed to have a positive claimed flag in their current
-   // position.  An atom that can react (i.e., it and its reacting
-   // neighbor are trying to participate in exactly 1 reaction) has a
-   // claimed flag value of exactly 1 in both its position and the
-   // position of the neighboring reactive atom.  An atom that
-   // cannot react has a claimed flag value greater than 1 in one
-   // or both of these positions.
-   //
-   // Below, as the world is scanned, an atom will be marked as
-   // having reacted by setting its claimed flag value to 0.  This
-   // speeds up checking as the scan moves through the world.
 
-   for( int y = 0; y < o->worldY; y++ )
+// Find the reactions attempted in row y that pass the
+// probability test by geometric skip sampling.  Each
+// position passes with probability at most
+// q = 2^-rxnSkipShift, so the positions are first thinned
+// to candidates, each taken with probability q, and a
+// candidate then passes if its attempt passes with every
+// probability scaled by 1/q.  The random numbers are those
+// of the row in randNums, so that the attempts found do not
+// depend on the order in which the rows are visited.  The
+// number r of the position where a search starts makes it
+// a candidate if r < q 2^61, with r / q as the number of
+// its attempt; otherwise r is uniform in [q 2^61, 2^61) and
+// gives the gap to the next candidate, whose attempt takes
+// its own number.  The numbers of the positions skipped go
+// unused.  The gaps run across the whole row, so that the
+// candidates do not depend on how the row is split into
+// segments either.
+template<bool SECOND_ORDER>
+void
+Sim::findRxnAttemptsSkipRow( int y )
+{
+   const uint64_t* rand = randNums + ( y & randRowMask ) * (int64_t)o->worldX;
+   const uint64_t cut = (uint64_t)1 << ( 61 - rxnSkipShift );
+   const double span = (double)( ( (uint64_t)1 << 61 ) - cut );
+   int x = 0;
+   while( x < o->worldX )
    {
-      for( int x = 0; x < o->worldX; x++ )
+      uint64_t r = rand[ x ] >> 3;
+      if( r < cut )
+      // If the position is a candidate
       {
-         if( claimed[ getWorldIndex(x,y) ] == 1 )
-         // If something is encountered that has not been processed yet
-         // and could undergo a reaction
-         {
-            if( world[ getWorldIndex(x,y) ] != NULL )
-            // If an atom is encountered
-            {
-               thisAtom = world[ getWorldIndex(x,y) ];
-            }
-            else
-            // Else solvent is encountered
-            {
-               thisAtom = new Atom( solventEle, x, y );
-            }
-
-            // Determine which neighbor to attempt to react with, if any
-            switch( (randNums[ getWorldIndex(x,y) ] >> 3) % 5 )
-            {
-               case 0:  // First-order
-                  neighborX = x+0;
-                  neighborY = y+0;
-                  break;
-               case 1:  // Second-order (E)
-                  neighborX = x+1;
-                  neighborY = y+0;
-                  break;
-               case 2:  // Second-order (SE)
-                  neighborX = x+1;
-                  neighborY = y+1;
-                  break;
-               case 3:  // Second-order (S)
-                  neighborX = x+0;
-                  neighborY = y+1;
-                  break;
-               case 4:  // Second-order (SW)
-                  neighborX = x-1;
-                  neighborY = y+1;
-                  break;
-               default:
-                  assert( 0 );
-                  break;
-            }
-            if( neighborX == x && neighborY == y )
-            {
-               neighborAtom = NULL;
-            }
-            else
-            {
-               if( world[ getWorldIndex(neighborX,neighborY) ] != NULL )
-               {
-                  neighborAtom = world[ getWorldIndex(neighborX,neighborY) ];
-               }
-               else
-               {
-                  neighborAtom = new Atom( solventEle, neighborX, neighborY );
-               }
-            }
-
-            // Determine the appropriate Reaction
-            Reaction* thisRxn;
-            std::pair<ReactionMap::iterator,ReactionMap::iterator> range;
-            if( neighborAtom == NULL )
-            // If the reaction is first-order
-               range = rxnTable.equal_range( thisAtom->getType()->getKey() );
-            else
-            // Else the reaction is second-order
-               if( claimed[ getWorldIndex(neighborX,neighborY) ] == 1 )
-               // If the neighbor has not been processed yet and
-               // could undergo a reaction
-                  range = rxnTable.equal_range( thisAtom->getType()->getKey() *
-                                            neighborAtom->getType()->getKey() );
-               else
-               // Else the neighbor has been processes already or
-               // has too many claims on it, so initialize the range
-               // with an empty set
-                  range = rxnTable.equal_range( -1 );
-            // Find the n'th Reaction with the matching set of
-            // reactants, where n is a random number between 0 and
-            // MAX_RXNS_PER_SET_OF_REACTANTS
-            ReactionMap::iterator i = range.first;
-            for( unsigned int j = 0; j < (randNums[ getWorldIndex(x,y) ] >> 3) % MAX_RXNS_PER_SET_OF_REACTANTS; j++ )
-            {
-               if( i != range.second )
-                  i++;
-               else
-                  break;
-            }
-            if( i != range.second )
-               thisRxn = i->second;
-            else
-               thisRxn = NULL;
-
-            // Perform the reaction
-            if( thisRxn != NULL &&
-                (double)(randNums[ getWorldIndex(x,y) ] >> 3) /
-                (double)((uint64_t)1 << (8 * sizeof(*randNums) - 3))
-                  < thisRxn->getProb() )
-            // If the reactant have enough energy
-            {
-               if( neighborAtom == NULL )
-               // If the reaction is first-order
-               {
-                  // Execute the reaction
-                  thisAtom->setType( thisRxn->getProducts()[0] );
-                  world[ getWorldIndex(x,y) ] = thisAtom;
-
-                  // Mark the atom as having already reacted
-                  claimed[ getWorldIndex(x,y) ] = 0;
-               }
-               else
-               // Else the reaction is second-order
-               {
-                  // Execute the reaction
-                  thisAtom->setType( thisRxn->getProducts()[0] );
-                  neighborAtom->setType( thisRxn->getProducts()[1] );
-                  world[ getWorldIndex(x,y) ] = thisAtom;
-                  world[ getWorldIndex(neighborX,neighborY) ] = neighborAtom;
-
-                  // Propogate tracking
-                  thisAtom->setTracked(     thisAtom->isTracked() || neighborAtom->isTracked() );
-                  neighborAtom->setTracked( thisAtom->isTracked() || neighborAtom->isTracked() );
-
-                  // Mark the reaction participants as having already reacted
-                  claimed[ getWorldIndex(x,y) ] = 0;
-                  claimed[ getWorldIndex(neighborX,neighborY) ] = 0;
-               }
-            }
-
-            // Delete any solvent atoms that are newly created or never reacted
-            if( thisAtom->getType() == solventEle )
-            {
-               delete thisAtom;
-               thisAtom = NULL;
-               world[ getWorldIndex(x,y) ] = NULL;
-            }
-            if( neighborAtom != NULL && neighborAtom->getType() == solventEle )
-            {
-               delete neighborAtom;
-               neighborAtom = NULL;
-               world[ getWorldIndex(neighborX,neighborY) ] = NULL;
-            }
-         }
+         findRxnAttempt<SECOND_ORDER>( x, y, r << rxnSkipShift, rxnSkipShift );
+         x++;
+         continue;
+      }
+
+      // log(u) / log(1-q) for u uniform in (0,1]
+      double u = (double)( r - cut + 1 ) / span;
+      double gap = log( u ) * rxnSkipLogScale;
+      if( gap >= o->worldX - x - 1 )
+         break;
+      x += 1 + (int)gap;
+      findRxnAttempt<SECOND_ORDER>( x, y, rand[ x ] >> 3, rxnSkipShift );
+      x++;
+   }
+}
+
+
+// The stages of moveAtoms and executeRxns are shared with
+// the distributed engine
+template void Sim::moveAtomsSegment<true>( int y, int x0, int x1 );
+template void Sim::moveAtomsSegment<false>( int y, int x0, int x1 );
+template void Sim::findRxnAttemptsSegment<true>( int y, int x0, int x1 );
+template void Sim::findRxnAttemptsSegment<false>( int y, int x0, int x1 );
+template void Sim::findRxnAttemptsSkipRow<true>( int y );
+template void Sim::findRxnAttemptsSkipRow<false>( int y );
+template void Sim::resolveRxnAttempts<true,true>( unsigned int begin, unsigned int end );
+template void Sim::resolveRxnAttempts<true,false>( unsigned int begin, unsigned int end );
+template void Sim::resolveRxnAttempts<false,true>( unsigned int begin, unsigned int end );
+template void Sim::resolveRxnAttempts<false,false>( unsigned int begin, unsigned int end );
+
+
+// Determine which neighbor and which reaction the position
+// (x,y) attempts with the random number rand (of 61 bits),
+// and record the attempt if it passes the probability test
+// with every probability scaled up by 2^shift; unless
+// SECOND_ORDER is true, only first-order reactions are
+// possible
+template<bool SECOND_ORDER>
+inline void
+Sim::findRxnAttempt( int x, int y, uint64_t rand, int shift )
+{
+   const int nIndices = rxnIndices;
+   int64_t site = rowOffset[ y ] + colOffset[ x ];
+#ifdef HAVE_COMPILED_CHEMISTRY
+   const uint16_t* pairs = compiledRxnPairs;
+   const uint64_t* thresholds = compiledRxnThresholds;
+   const int* pairChannels = compiledRxnPairChannels;
+   const int* pairEntries = compiledRxnPairEntries;
+
+   // Skip the atoms that cannot start any reaction
+   if( !compiledReactive[ lattice[ site ] ] )
+      return;
+#else
+   const uint16_t* pairs = rxnPairs;
+   const uint64_t* thresholds = rxnThresholds;
+   const int* pairChannels = rxnPairChannels;
+   const int* pairEntries = rxnPairEntries;
+#endif
+
+   // Determine which neighbor to attempt to react with, if any
+   int slot = rand % 5;
+   int64_t partner = site;
+   int partnerIndex = nIndices;
+   if( !SECOND_ORDER && slot != 0 )
+      return;
+   if( slot != 0 )
+   {
+      int neighborX = x + rxndx[ slot ];
+      int neighborY = y + rxndy[ slot ];
+      if( neighborX < 0 )
+         neighborX += o->worldX;
+      else if( neighborX >= o->worldX )
+         neighborX -= o->worldX;
+      if( neighborY >= o->worldY )
+         neighborY -= o->worldY;
+      partner = rowOffset[ neighborY ] + colOffset[ neighborX ];
+      partnerIndex = lattice[ partner ];
+   }
+
+   // Look up the pair of reactants, which has no reactions
+   // more often than not
+   int pair = pairs[ lattice[ site ] * ( nIndices + 1 ) + partnerIndex ];
+   if( pair == 0 )
+      return;
+
+   // Look up the Reaction in a random channel of the pair
+   // and perform the probability test
+   int channels = pairChannels[ pair ];
+   int channel = ( channels == 2 ) ? rand & 1 : rand % channels;
+   int entry = pairEntries[ pair ] + channel;
+   if( rand < ( thresholds[ entry ] << shift ) )
+   // If the reactants have enough energy
+   {
+      RxnAttempt attempt;
+      attempt.x = x;
+      attempt.y = y;
+      attempt.site = site;
+      attempt.partner = partner;
+      attempt.slot = slot;
+      attempt.rxn = rxnChoices[ entry ];
+      rxnAttempts.push_back( attempt );
+   }
+}
+
+
+// Determine which neighbor and which reaction the position
+// (x,y) attempts, and record the attempt if it passes the
+// probability test
+template<bool SECOND_ORDER>
+void
+Sim::findRxnAttempt( int x, int y )
+{
+   findRxnAttempt<SECOND_ORDER>( x, y, randNums[ ( y & randRowMask ) * (int64_t)o->worldX + x ] >> 3, 0 );
+}
+
+
+// Execute a reaction that has passed the probability
+// test and has no competing claims; tracking is
+// propagated only if TRACKING is true
+template<bool TRACKING>
+void
+Sim::executeRxn( RxnAttempt& attempt )
+{
+   Element* solventEle = elementsByIndex[ 0 ];
+   int x = attempt.x;
+   int y = attempt.y;
+   int64_t site = x + (int64_t)y * o->worldX;
+   int64_t partner = getWorldIndex( x + rxndx[ attempt.slot ], y + rxndy[ attempt.slot ] );
+   Atom* thisAtom;
+   Atom* neighborAtom;
+
+   if( world[ site ] != NULL )
+   // If an atom is encountered
+   {
+      thisAtom = world[ site ];
+   }
+   else
+   // Else solvent is encountered
+   {
+      thisAtom = new Atom( solventEle, x, y );
+   }
+
+   if( attempt.slot == 0 )
+   // If the reaction is first-order
+   {
+      neighborAtom = NULL;
+
+      // Execute the reaction
+      thisAtom->setType( attempt.rxn->getProducts()[0] );
+      world[ site ] = thisAtom;
+      lattice[ attempt.site ] = thisAtom->getType()->getIndex();
+   }
+   else
+   // Else the reaction is second-order
+   {
+      if( world[ partner ] != NULL )
+      {
+         neighborAtom = world[ partner ];
+      }
+      else
+      {
+         neighborAtom = new Atom( solventEle, x + rxndx[ attempt.slot ], y + rxndy[ attempt.slot ] );
+      }
+
+      // Execute the reaction
+      thisAtom->setType( attempt.rxn->getProducts()[0] );
+      neighborAtom->setType( attempt.rxn->getProducts()[1] );
+      world[ site ] = thisAtom;
+      world[ partner ] = neighborAtom;
+      lattice[ attempt.site ] = thisAtom->getType()->getIndex();
+      lattice[ attempt.partner ] = neighborAtom->getType()->getIndex();
+
+      // Propogate tracking
+      if( TRACKING )
+      {
+         thisAtom->setTracked(     thisAtom->isTracked() || neighborAtom->isTracked() );
+         neighborAtom->setTracked( thisAtom->isTracked() || neighborAtom->isTracked() );
+      }
+   }
+
+   // Delete any solvent atoms that are newly created or
+   // were produced by the reaction
+   if( thisAtom->getType() == solventEle )
+   {
+      delete thisAtom;
+      world[ site ] = NULL;
+   }
+   if( neighborAtom != NULL && neighborAtom->getType() == solventEle )
+   {
+      delete neighborAtom;
+      world[ partner ] = NULL;
+   }
+}
+
+
+// Move atoms and execute reactions in a single pass over
+// the world.  moveAtoms and executeRxns each stream the
+// whole world through the cache several times; here the
+// same stages are applied band by band, each stage trailing
+// the one before it by only the rows it depends on, so that
+// the rows of a band are still in the cache as they pass
+// through every stage.  The stages, and the rows of the
+// previous stage that each needs to have been completed
+// before it can process row y, are:
+//
+//   0  find move intents           -
+//   1  count move claims           rows y-1 through y+1
+//   2  move atoms                  rows y-1 through y+1
+//   3  find and claim reactions    rows y-1 through y+2
+//   4  execute reactions           rows y-1 through y+1
+//
+// Stage s visits the rows in the order s, s+1, ..., wrapping
+// around to finish with row s-1, so that no stage waits on
+// a row that the stage before it will not reach until the
+// end of the sweep.  By the time the reaction claims for a
+// row are staked, every atom that needs the move claims for
+// that row has been moved, so claimed is reused for both as
+// in executeRxns.
+template<bool STATS, bool TRACKING, bool SECOND_ORDER>
+void
+Sim::sweepWorld()
+{
+   const int nStages = o->doRxns ? 5 : 3;
+   const int reach[] = { 0, 1, 1, 2, 1 };
+
+   // Worlds too short to keep the stages apart are handled
+   // by the unfused passes
+   if( o->worldY < 2 * nStages )
+   {
+      moveAtoms<STATS>();
+      if( o->doRxns )
+         executeRxns<TRACKING,SECOND_ORDER>();
+      return;
+   }
+
+   // Size bands to keep about 256 KB of the world in flight
+   int rowBytes = o->worldX * ( sizeof( *randNums ) + sizeof( *lattice ) + sizeof( *moveDirBits ) + sizeof( *claimed ) + sizeof( *world ) );
+   int bandRows = std::max( 1, ( 256 * 1024 ) / rowBytes );
+
+   rxnAttempts.clear();
+   rxnAttemptsEnd.resize( o->worldY );
+   nextRxnClaimsEpoch();
+
+   // done[s] counts the rows that stage s has completed
+   int done[] = { 0, 0, 0, 0, 0 };
+   while( done[ nStages - 1 ] < o->worldY )
+   {
+      for( int s = 0; s < nStages; s++ )
+      {
+         // The row in position i of stage s depends on the
+         // rows in positions i through i+1+reach[s] of stage
+         // s-1, which wrap around to position 0 at the end
+         int stop = std::min( done[s] + bandRows, o->worldY );
+         if( s > 0 && done[ s - 1 ] < o->worldY )
+            stop = std::min( stop, done[ s - 1 ] - 1 - reach[s] );
+
+         for( ; done[s] < stop; done[s]++ )
+            sweepRow<STATS,TRACKING,SECOND_ORDER>( s, ( s + done[s] ) % o->worldY );
       }
    }
 }
 
+
+// Apply stage s of sweepWorld to row y
+template<bool STATS, bool TRACKING, bool SECOND_ORDER>
+void
+Sim::sweepRow( int s, int y )
+{
+   unsigned int begin;
+
+   switch( s )
+   {
+      case 0:
+         forEachSegmentInRow( &Sim::findMoveIntentsSegment, y );
+         break;
+      case 1:
+         forEachSegmentInRow( &Sim::countMoveClaimsSegment, y );
+         break;
+      case 2:
+         forEachSegmentInRow( &Sim::moveAtomsSegment<STATS>, y );
+         break;
+      case 3:
+         begin = rxnAttempts.size();
+         if( rxnSkipShift > 0 )
+            findRxnAttemptsSkipRow<SECOND_ORDER>( y );
+         else
+            forEachSegmentInRow( &Sim::findRxnAttemptsSegment<SECOND_ORDER>, y );
+         if( SECOND_ORDER )
+            claimRxnAttempts( begin, rxnAttempts.size() );
+         rxnAttemptsEnd[ y ] = rxnAttempts.size();
+         break;
+      case 4:
+         // The attempts from row y follow those from the row
+         // before it, except in the first row visited by
+         // stage 3
+         if( y == 3 )
+            begin = 0;
+         else
+            begin = rxnAttemptsEnd[ ( y == 0 ? o->worldY : y ) - 1 ];
+         resolveRxnAttempts<TRACKING,SECOND_ORDER>( begin, rxnAttemptsEnd[ y ] );
+         break;
+   }
+}
+
+
+// Choose the variants of the engine that iterate calls.
+// The kernels are compiled separately for each combination
+// of the features that cost something for every atom or
+// every reaction, so that a run pays nothing for those it
+// does not use: the diffusion statistics of each atom, the
+// tracking of atoms (which only the Qt GUI can turn on),
+// and second-order reactions (without which no reactions
+// can compete for a position).
+void
+Sim::selectEngine()
+{
+   bool stats = o->doDiffusion;
+   bool tracking = ( o->gui == Options::GUI_QT );
+#ifdef HAVE_COMPILED_CHEMISTRY
+   bool secondOrder = COMPILED_SECOND_ORDER;
+#else
+   bool secondOrder = false;
+   for( ReactionMap::iterator i = rxnTable.begin(); i != rxnTable.end(); i++ )
+      if( i->second->getReactants().size() > 1 )
+         secondOrder = true;
+#endif
+
+   switch( stats * 4 + tracking * 2 + secondOrder )
+   {
+      case 0: selectEngine<false,false,false>(); break;
+      case 1: selectEngine<false,false,true>();  break;
+      case 2: selectEngine<false,true,false>();  break;
+      case 3: selectEngine<false,true,true>();   break;
+      case 4: selectEngine<true,false,false>();  break;
+      case 5: selectEngine<true,false,true>();   break;
+      case 6: selectEngine<true,true,false>();   break;
+      case 7: selectEngine<true,true,true>();    break;
+   }
+}
+
+
+// Point moveEngine and rxnEngine at the variants of the
+// move and reaction phases compiled for the given features
+template<bool STATS, bool TRACKING, bool SECOND_ORDER>
+void
+Sim::selectEngine()
+{
+   rxnEngine = NULL;
+   if( o->ssa != Options::SSA_OFF )
+   {
+      moveEngine = &Sim::ssaAdvance;
+   }
+   else if( o->doWellMixed )
+   {
+      moveEngine = &Sim::mixedAdvance;
+   }
+   else if( o->doKMC )
+   {
+      moveEngine = &Sim::kmcAdvance<STATS,TRACKING,SECOND_ORDER>;
+   }
+   else if( o->doFused )
+   {
+      moveEngine = &Sim::sweepWorld<STATS,TRACKING,SECOND_ORDER>;
+   }
+   else if( o->lean )
+   {
+      moveEngine = &Sim::leanMoveAtoms;
+      if( o->doRxns )
+         rxnEngine = &Sim::leanExecuteRxns<SECOND_ORDER>;
+   }
+#ifdef HAVE_MPI
+   else if( mpiRanks > 1 )
+   {
+      moveEngine = &Sim::mpiMoveAtoms<STATS>;
+      if( o->doRxns )
+         rxnEngine = &Sim::mpiExecuteRxns<TRACKING,SECOND_ORDER>;
+   }
+#endif
+   else
+   {
+      if( o->doBitplanes )
+         moveEngine = &Sim::moveAtomsBitplanes<STATS>;
+      else
+         moveEngine = &Sim::moveAtoms<STATS>;
+      if( o->doRxns )
+         rxnEngine = &Sim::executeRxns<TRACKING,SECOND_ORDER>;
+   }
+}
@@ -9,6 +9,7 @@
 #include <fstream>
 #include <iomanip> // setw
 #include <iostream>
+#include <sstream>
 #ifdef HAVE_NCURSES
 #include <ncurses.h>
 #endif
@@ -36,12 +37,18 @@ Sim::initializeIO()
 
       // Take an initial census
       writeCensus();
+      if( expectedOut != NULL )
+         writeExpectedCensus();
 
       // Set the time for the most recent progress report
       // printout to "a long time ago and well overdue"
       // (i.e., never).
       lastProgressUpdate = 0;
 
+      // Find where the processes and their memory were placed
+      if( o->numa || o->pin )
+         findPlacement();
+
       if( o->gui == Options::GUI_NCURSES )
       {
 #ifdef HAVE_NCURSES
@@ -58,6 +65,9 @@ Sim::initializeIO()
             printRxns( &screen );
             screen << std::endl;
             printExtincts( &screen );
+            screen << std::endl;
+            printMemory( &screen );
+            printPlacement( &screen );
             screen << "------" << std::endl;
          }
 
@@ -77,8 +87,18 @@ Sim::initializeIO()
             printRxns( &std::cout );
             std::cout << std::endl;
             printExtincts( &std::cout );
+            std::cout << std::endl;
+            printMemory( &std::cout );
+            printPlacement( &std::cout );
             std::cout << "------" << std::endl;
          }
+
+         // A lean world is chosen for the memory it saves, so
+         // its memory budget is printed in any case
+         else if( o->lean && mpiRank == 0 )
+         {
+            printMemory( &std::cout );
+         }
       }
    }
 }
@@ -93,6 +113,18 @@ Sim::openFiles()
    tempFiles = std::vector<QTemporaryFile*>( Options::N_FILES );
 #endif
 
+#ifdef HAVE_MPI
+   // Only the first rank writes files; the others discard
+   // what they would write, and send their diffusion data to
+   // the first rank's file through MPI
+   if( mpiRank != 0 )
+   {
+      for( int i = 0; i < Options::N_FILES; i++ )
+         out[i] = new std::ostream( NULL );
+      return;
+   }
+#endif
+
    // Ignore default file names or file names read-in as
    // arguments if the Qt gui is being used
    if( o->gui == Options::GUI_QT )
@@ -156,6 +188,18 @@ Sim::openFiles()
          std::cerr << "openFiles: unable to open file \"" << o->filePaths[ Options::FILE_RAND ] << "\"!" << std::endl;
          exit( EXIT_FAILURE );
    }
+
+   // The expected census is written only if asked for
+   expectedOut = NULL;
+   if( !o->expectedPath.empty() )
+   {
+      expectedOut = new std::ofstream( o->expectedPath.c_str() );
+      if( expectedOut->fail() )
+      {
+         std::cerr << "openFiles: unable to open file \"" << o->expectedPath << "\"!" << std::endl;
+         exit( EXIT_FAILURE );
+      }
+   }
 }
 
 
@@ -212,6 +256,11 @@ Sim::loadChemistry()
 
             o->loadFile >> name >> symbol >> color >> startConc;
             tempEle = new Element( name, symbol, color, startConc );
+            if( tempEle->getIndex() > (int)MAX_ELES_NOT_INCLUDING_SOLVENT )
+            {
+               std::cerr << "Loading ele: limit of " << MAX_ELES_NOT_INCLUDING_SOLVENT << " Elements exceeded!" << std::endl;
+               exit( EXIT_FAILURE );
+            }
             periodicTable[ name ] = tempEle;
             elesLoaded = true;
             while( o->loadFile.peek() == ' ' )
@@ -366,17 +415,8 @@ Sim::loadChemistry()
 
             // Create the reaction and store it in the rxnTable
             tempRxn = new Reaction( reactants, products, prob );
-            if( rxnTable.count( tempRxn->getKey() ) < MAX_RXNS_PER_SET_OF_REACTANTS )
-            {
-               rxnTable.insert( std::pair<int,Reaction*>( tempRxn->getKey(), tempRxn ) );
-               rxnsLoaded = true;
-            }
-            else
-            {
-               std::cerr << "Loading rxn: the limit of " << MAX_RXNS_PER_SET_OF_REACTANTS <<
-                  " reactions per set of reactants has been exceeded!" << std::endl;
-               exit( EXIT_FAILURE );
-            }
+            rxnTable.insert( std::pair<int,Reaction*>( tempRxn->getKey(), tempRxn ) );
+            rxnsLoaded = true;
          }
 
          // Read in extincts
@@ -419,9 +459,18 @@ Sim::writeConfig()
    *(out[ Options::FILE_CONFIG ]) << "seed "      << o->seed << std::endl;
    *(out[ Options::FILE_CONFIG ]) << "iters "     << itersCompleted << std::endl;
    *(out[ Options::FILE_CONFIG ]) << "x "         << o->worldX << std::endl;
-   *(out[ Options::FILE_CONFIG ]) << "y "         << o->worldY << std::endl;
+   *(out[ Options::FILE_CONFIG ]) << "y "         << worldRows << std::endl;
    *(out[ Options::FILE_CONFIG ]) << "reactions " << (o->doRxns ? "on" : "off") << std::endl;
    *(out[ Options::FILE_CONFIG ]) << "shuffle "   << (o->doShuffle ? "on" : "off") << std::endl;
+   *(out[ Options::FILE_CONFIG ]) << "build "     << (o->classicBuild && !o->lean ? "classic" : "sampled") << std::endl;
+   if( o->autotune )
+   {
+      // Record the choice of the tuner, so that the run can
+      // be repeated by loading this file
+      *(out[ Options::FILE_CONFIG ]) << "engine "    << (o->doFused ? "fused" : o->doBitplanes ? "bitplanes" : "bytes") << std::endl;
+      *(out[ Options::FILE_CONFIG ]) << "tiled "     << (o->doTiled ? "on" : "off") << std::endl;
+      *(out[ Options::FILE_CONFIG ]) << "simd "      << (o->doSIMD ? "on" : "off") << std::endl;
+   }
    *(out[ Options::FILE_CONFIG ]) << std::endl;
 
    // Write Elements to file
@@ -444,7 +493,13 @@ void
 Sim::writeCensus()
 {
    int colwidth = 12;
-   int totalAtoms = 0;
+   int64_t totalAtoms = 0;
+
+#ifdef HAVE_MPI
+   // Sum the atoms of every rank
+   if( mpiRanks > 1 )
+      mpiReduceCounts();
+#endif
 
    static bool initialized = false;
    if( !initialized )
@@ -470,14 +525,60 @@ Sim::writeCensus()
       Element* ele = i->second;
       if( ele != periodicTable[ "Solvent" ] )
       {
-         *(out[ Options::FILE_CENSUS ]) << std::setw(colwidth) << ele->count;
+         *(out[ Options::FILE_CENSUS ]) << std::setw(colwidth) << censusCount( ele );
       }
-      totalAtoms += ele->count;
+      totalAtoms += censusCount( ele );
    }
    *(out[ Options::FILE_CENSUS ]) << std::setw(colwidth) << totalAtoms << std::endl;
 }
 
 
+// Writes the census expected from the rate laws at the
+// current iteration, in the same layout as writeCensus
+void
+Sim::writeExpectedCensus()
+{
+   int colwidth = 12;
+   double totalAtoms = 0;
+
+   static bool initialized = false;
+   if( !initialized )
+   {
+      initialized = true;
+
+      expectedOut->flags(std::ios::left);
+      *expectedOut << std::setw(colwidth) << "iter";
+      for( ElementMap::iterator i = periodicTable.begin(); i != periodicTable.end(); i++ )
+      {
+         Element* ele = i->second;
+         if( ele != periodicTable[ "Solvent" ] )
+         {
+            *expectedOut << std::setw(colwidth) << ele->getName().c_str();
+         }
+      }
+      *expectedOut << std::setw(colwidth) << "total" << std::endl;
+      *expectedOut << std::fixed << std::setprecision(3);
+
+      // Start from the atoms actually placed in the world
+      odeInit();
+   }
+
+   odeAdvance( itersCompleted );
+
+   *expectedOut << std::setw(colwidth) << itersCompleted;
+   for( ElementMap::iterator i = periodicTable.begin(); i != periodicTable.end(); i++ )
+   {
+      Element* ele = i->second;
+      if( ele != periodicTable[ "Solvent" ] )
+      {
+         *expectedOut << std::setw(colwidth) << odeState[ ele->getIndex() ];
+      }
+      totalAtoms += odeState[ ele->getIndex() ];
+   }
+   *expectedOut << std::setw(colwidth) << totalAtoms << std::endl;
+}
+
+
 // Writes important information about the state
 // of the world to file; to be called when the
 // simulation ends
@@ -485,36 +586,64 @@ void
 Sim::writeDiffusion()
 {
    int colwidth = 12;
+   std::ostream* diffusion = out[ Options::FILE_DIFFUSION ];
+
+#ifdef HAVE_MPI
+   // Under MPI each rank writes the atoms of its slab to the
+   // file at once, after those of the ranks above it
+   std::ostringstream slab;
+   if( mpiRanks > 1 )
+      diffusion = &slab;
+#endif
 
-   out[ Options::FILE_DIFFUSION ]->flags(std::ios::left);
-   *(out[ Options::FILE_DIFFUSION ]) << std::setw(colwidth) <<
-      "type" << std::setw(colwidth) <<
-      "x" << std::setw(colwidth) <<
-      "y" << std::setw(colwidth) <<
-      "dx_actual" << std::setw(colwidth) <<
-      "dy_actual" << std::setw(colwidth) <<
-      "dx_ideal" << std::setw(colwidth) <<
-      "dy_ideal" << std::setw(colwidth) <<
-      "collisions" << std::endl;
-   for( int x = 0; x < o->worldX; x++ )
+   diffusion->flags(std::ios::left);
+   if( mpiRank == 0 )
    {
-      for( int y = 0; y < o->worldY; y++ )
+      // The kinetic Monte Carlo engine moves atoms one at a
+      // time, so they collide only with atoms already at
+      // their destination
+      if( o->doKMC )
+         *diffusion << "# --kmc: atoms collided only with atoms already at their destination;" << std::endl <<
+            "# diffusion and collisions are not comparable with the other engines" << std::endl;
+      *diffusion << std::setw(colwidth) <<
+         "type" << std::setw(colwidth) <<
+         "x" << std::setw(colwidth) <<
+         "y" << std::setw(colwidth) <<
+         "dx_actual" << std::setw(colwidth) <<
+         "dy_actual" << std::setw(colwidth) <<
+         "dx_ideal" << std::setw(colwidth) <<
+         "dy_ideal" << std::setw(colwidth) <<
+         "collisions" << std::endl;
+   }
+
+   // The statistics are not kept with --diffusion-off
+   if( o->doDiffusion )
+   {
+      for( int x = 0; x < o->worldX; x++ )
       {
-         if( world[ getWorldIndex(x,y) ] != NULL )
+         for( int y = 0; y < slabRows; y++ )
          {
-            Atom* thisAtom = world[ getWorldIndex(x,y) ];
-            *(out[ Options::FILE_DIFFUSION ]) << std::setw(colwidth) <<
-               thisAtom->getType()->getName().c_str() << std::setw(colwidth) <<
-               thisAtom->x << std::setw(colwidth) <<
-               thisAtom->y << std::setw(colwidth) <<
-               thisAtom->dx_actual << std::setw(colwidth) <<
-               thisAtom->dy_actual << std::setw(colwidth) <<
-               thisAtom->dx_ideal << std::setw(colwidth) <<
-               thisAtom->dy_ideal << std::setw(colwidth) <<
-               thisAtom->collisions << std::endl;
+            if( getAtom(x,y) != NULL )
+            {
+               Atom* thisAtom = getAtom(x,y);
+               *diffusion << std::setw(colwidth) <<
+                  thisAtom->getType()->getName().c_str() << std::setw(colwidth) <<
+                  thisAtom->x << std::setw(colwidth) <<
+                  thisAtom->y + slabY << std::setw(colwidth) <<
+                  thisAtom->dx_actual << std::setw(colwidth) <<
+                  thisAtom->dy_actual << std::setw(colwidth) <<
+                  thisAtom->dx_ideal << std::setw(colwidth) <<
+                  thisAtom->dy_ideal << std::setw(colwidth) <<
+                  thisAtom->collisions << std::endl;
+            }
          }
       }
    }
+
+#ifdef HAVE_MPI
+   if( mpiRanks > 1 )
+      mpiWriteDiffusion( slab.str() );
+#endif
 }
 
 
@@ -586,8 +715,8 @@ Sim::printWorld()
       // Print contents of world
       for( int x = 0; x < o->worldX; x++ )
       {
-         if( world[ getWorldIndex(x,y) ] != NULL )
-            screen << world[ getWorldIndex(x,y) ]->getType()->getSymbol() << " ";
+         if( getSpecies(x,y) != NULL )
+            screen << getSpecies(x,y)->getSymbol() << " ";
          else
             screen << "  ";
       }
@@ -735,3 +864,39 @@ Sim::printExtincts( std::ostream* out )
    }
 }
 
+
+// Print the memory taken by the arrays of the world to an
+// output stream, in MB and in bytes per position
+void
+Sim::printMemory( std::ostream* out )
+{
+   double nPositions = (double)o->worldX * (double)o->worldY;
+   int64_t nAtoms = 0;
+   for( unsigned int i = 1; i < elementsByIndex.size(); i++ )
+      if( elementsByIndex[ i ] != NULL )
+         nAtoms += elementsByIndex[ i ]->count;
+
+   const int nArrays = 8;
+   const char* names[ nArrays ] = { "lattice", "claimed", "moveDirBits", "world", "Atoms", "positions", "bitplanes", "random numbers" };
+   double bytes[ nArrays ];
+   bytes[0] = ( lattice != NULL ) ? (double)latticeSize : 0;
+   bytes[1] = ( claimed != NULL ) ? (double)latticeSize : 0;
+   bytes[2] = ( moveDirBits != NULL ) ? (double)latticeSize : 0;
+   bytes[3] = ( world != NULL ) ? nPositions * sizeof( Atom* ) : 0;
+   bytes[4] = ( world != NULL ) ? (double)nAtoms * sizeof( Atom ) : 0;
+   bytes[5] = ( positions != NULL ) ? nPositions * sizeof( unsigned int ) : 0;
+   bytes[6] = ( occupancyPlane != NULL ) ? 5.0 * planeWords * o->worldY * sizeof( uint64_t ) : 0;
+   bytes[7] = (double)randNums_length_in_64_bit_ints * sizeof( uint64_t );
+   if( randNumsNext != NULL )
+      bytes[7] += (double)randNums_length_in_64_bit_ints * sizeof( uint64_t );
+
+   double total = 0;
+   for( int i = 0; i < nArrays; i++ )
+   {
+      if( bytes[i] > 0 )
+         *out << "memory " << names[i] << " " << bytes[i] / 1048576 << " MB (" << bytes[i] / nPositions << " bytes per position)" << std::endl;
+      total += bytes[i];
+   }
+   *out << "memory total " << total / 1048576 << " MB (" << total / nPositions << " bytes per position)" << std::endl;
+   *out << "memory arena " << arena.getCapacity() / 1048576.0 << " MB" << std::endl;
+}
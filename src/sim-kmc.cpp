@@ -0,0 +1,404 @@
+/* sim-kmc.cpp
+ */
+
+#include <cmath> // log
+#include "sim.h"
+
+
+// Advance the world by one unit of time (one iteration)
+// with a kinetic Monte Carlo engine in the manner of Bortz,
+// Kalos and Lebowitz.  Rather than giving every atom one
+// chance to move and every position one chance to react
+// each iteration, the engine keeps track of the rate of
+// every event that could happen next, picks one with
+// probability proportional to its rate, executes it, and
+// advances the clock by an exponentially distributed
+// waiting time.  Each atom attempts a move once per unit
+// of time, and each of the 5 slots of a position attempts
+// each Reaction of its pair of reactants with probability
+// prob / ( 5 * c ) per unit of time, where c is the number
+// of channels of the pair, as in the synchronous engines.
+//
+// The diffusion and collision model is not that of the
+// synchronous engines, however.  Moves happen one at a
+// time, so an atom collides only with an atom already at
+// its destination, never with another atom moving to the
+// same empty position; atoms therefore diffuse faster, and
+// collide less often, than in the synchronous engines,
+// increasingly so as the world fills, and the kinetics
+// follow.  Runs are not comparable with those of the other
+// engines, and the collisions in the diffusion file count
+// something else.
+//
+// Reaction instances are grouped into classes by their
+// pair of reactants, so reactions are rejection-free and
+// the cost of an event does not depend on how many
+// instances can never react.  Moves are not: every atom
+// costs one event per unit of time, whether it moves or
+// collides, so the engine pays off only when atoms are
+// sparse, where the synchronous engines spend most of
+// their time on empty positions, and is slower than them
+// at the densities of the load files.  Unless SECOND_ORDER
+// is true, only the first-order slot of each position is
+// tracked.
+template<bool STATS, bool TRACKING, bool SECOND_ORDER>
+void
+Sim::kmcAdvance()
+{
+   // Shuffling rearranges the whole world, using up the
+   // random numbers, so the classes are rebuilt; otherwise
+   // only the tree of rates is rebuilt, to keep rounding
+   // errors from accumulating
+   if( o->doShuffle )
+      randCursor = randNums_length_in_64_bit_ints;
+   if( !kmcBuilt || o->doShuffle )
+      kmcBuild<SECOND_ORDER>();
+   else
+      kmcSumRates();
+
+   // Since waiting times are memoryless, the event that
+   // would come after the end of the iteration can be
+   // discarded
+   double t = 0;
+   while( true )
+   {
+      double totalRate = (double)kmcAtoms.size() + kmcRxnRate;
+      if( totalRate <= 0 )
+         break;
+      t -= std::log( nextUniform() ) / totalRate;
+      if( t >= 1 )
+         break;
+
+      if( nextUniform() * totalRate < (double)kmcAtoms.size() )
+      // If an atom attempts to move
+      {
+         uint64_t rand = nextRand();
+         int w = kmcAtoms[ ( rand >> 3 ) % kmcAtoms.size() ];
+         int x = w % o->worldX;
+         int y = w / o->worldX;
+         int dir = rand & 7;
+         int destX = x + dirdx[ dir ];
+         int destY = y + dirdy[ dir ];
+         if( destX < 0 )
+            destX += o->worldX;
+         else if( destX >= o->worldX )
+            destX -= o->worldX;
+         if( destY < 0 )
+            destY += o->worldY;
+         else if( destY >= o->worldY )
+            destY -= o->worldY;
+
+         // An atom collides only with an atom already at its
+         // destination
+         bool canMove = ( lattice[ rowOffset[ destY ] + colOffset[ destX ] ] == 0 );
+         moveAtom<STATS>( x, y, dir, canMove );
+         if( canMove )
+         {
+            int dest = destX + destY * o->worldX;
+            kmcAtoms[ kmcAtomIndex[ w ] ] = dest;
+            kmcAtomIndex[ dest ] = kmcAtomIndex[ w ];
+            kmcAtomIndex[ w ] = -1;
+            if( o->doRxns )
+            {
+               kmcUpdate<SECOND_ORDER>( x, y );
+               kmcUpdate<SECOND_ORDER>( destX, destY );
+            }
+         }
+      }
+      else
+      // Else a reaction occurs
+      {
+         kmcExecuteRxn<TRACKING,SECOND_ORDER>();
+      }
+   }
+}
+
+
+// The variant is chosen by selectEngine in sim-engine.cpp
+template void Sim::kmcAdvance<false,false,false>();
+template void Sim::kmcAdvance<false,false,true>();
+template void Sim::kmcAdvance<false,true,false>();
+template void Sim::kmcAdvance<false,true,true>();
+template void Sim::kmcAdvance<true,false,false>();
+template void Sim::kmcAdvance<true,false,true>();
+template void Sim::kmcAdvance<true,true,false>();
+template void Sim::kmcAdvance<true,true,true>();
+
+
+// Pick a reaction instance with probability proportional
+// to its rate, and a Reaction of its pair with probability
+// proportional to its prob, and execute it
+template<bool TRACKING, bool SECOND_ORDER>
+void
+Sim::kmcExecuteRxn()
+{
+   int pair = kmcTreeFind( nextUniform() * kmcRxnRate );
+
+   // Rounding errors can point past the last class with
+   // members, in which case nothing happens
+   if( pair <= 0 || pair >= (int)kmcMembers.size() || kmcMembers[ pair ].empty() )
+      return;
+
+   std::vector<int>& members = kmcMembers[ pair ];
+   int instance = members[ nextRand() % members.size() ];
+   double target = nextUniform() * kmcPairProbs[ pair ];
+   Reaction* rxn = NULL;
+   for( int channel = 0; channel < rxnPairChannels[ pair ]; channel++ )
+   {
+      Reaction* choice = rxnChoices[ rxnPairEntries[ pair ] + channel ];
+      if( choice == NULL )
+         continue;
+      rxn = choice;
+      target -= choice->getProb();
+      if( target < 0 )
+         break;
+   }
+   if( rxn == NULL )
+      return;
+
+   RxnAttempt attempt;
+   attempt.slot = instance % 5;
+   attempt.x = ( instance / 5 ) % o->worldX;
+   attempt.y = ( instance / 5 ) / o->worldX;
+   attempt.site = getLatticeIndex( attempt.x, attempt.y );
+   int partnerX = attempt.x + rxndx[ attempt.slot ];
+   int partnerY = attempt.y + rxndy[ attempt.slot ];
+   if( partnerX < 0 )
+      partnerX += o->worldX;
+   else if( partnerX >= o->worldX )
+      partnerX -= o->worldX;
+   if( partnerY >= o->worldY )
+      partnerY -= o->worldY;
+   attempt.partner = getLatticeIndex( partnerX, partnerY );
+   attempt.rxn = rxn;
+   executeRxn<TRACKING>( attempt );
+
+   // Atoms may have appeared or disappeared at either
+   // position, and both have changed species
+   kmcSyncAtom( attempt.x + attempt.y * o->worldX );
+   kmcUpdate<SECOND_ORDER>( attempt.x, attempt.y );
+   if( attempt.slot != 0 )
+   {
+      kmcSyncAtom( partnerX + partnerY * o->worldX );
+      kmcUpdate<SECOND_ORDER>( partnerX, partnerY );
+   }
+}
+
+
+// Build the list of atoms and the classes of reaction
+// instances from the world
+template<bool SECOND_ORDER>
+void
+Sim::kmcBuild()
+{
+   int nPositions = o->worldX * o->worldY;
+   if( kmcAtomIndex == NULL )
+   {
+      kmcAtomIndex = (int*)arena.allocate( nPositions * sizeof( int ) );
+      kmcClass = (uint16_t*)arena.allocate( 5 * nPositions * sizeof( uint16_t ) );
+      kmcIndex = (int*)arena.allocate( 5 * nPositions * sizeof( int ) );
+   }
+
+   kmcAtoms.clear();
+   for( int w = 0; w < nPositions; w++ )
+   {
+      kmcAtomIndex[ w ] = -1;
+      kmcSyncAtom( w );
+   }
+
+   // The rate of each instance of a pair is the sum of the
+   // probs of its Reactions, shared among the 5 slots and
+   // channels of the pair an attempt chooses from
+   int nPairs = 1;
+   for( int entry = 0; entry < rxnIndices * ( rxnIndices + 1 ); entry++ )
+      if( rxnPairs[ entry ] >= nPairs )
+         nPairs = rxnPairs[ entry ] + 1;
+   kmcMembers.assign( nPairs, std::vector<int>() );
+   kmcPairProbs.assign( nPairs, 0 );
+   kmcRates.assign( nPairs, 0 );
+   for( int pair = 1; pair < nPairs; pair++ )
+   {
+      int first = rxnPairEntries[ pair ];
+      for( int channel = 0; channel < rxnPairChannels[ pair ]; channel++ )
+         if( rxnChoices[ first + channel ] != NULL )
+            kmcPairProbs[ pair ] += rxnChoices[ first + channel ]->getProb();
+      kmcRates[ pair ] = kmcPairProbs[ pair ] / ( 5.0 * rxnPairChannels[ pair ] );
+   }
+
+   // Instances whose pair has no Reactions are never
+   // stored
+   for( int i = 0; i < 5 * nPositions; i++ )
+      kmcClass[ i ] = 0;
+   if( o->doRxns )
+      for( int y = 0; y < o->worldY; y++ )
+         for( int x = 0; x < o->worldX; x++ )
+            for( int slot = 0; slot < ( SECOND_ORDER ? 5 : 1 ); slot++ )
+               kmcClassify( x, y, slot );
+
+   kmcBuilt = true;
+   kmcSumRates();
+}
+
+
+// Rebuild the tree of class rates and the total rate of
+// reactions from the number of instances in each class
+void
+Sim::kmcSumRates()
+{
+   kmcTree.assign( kmcMembers.size() + 1, 0 );
+   kmcRxnRate = 0;
+   for( unsigned int pair = 1; pair < kmcMembers.size(); pair++ )
+   {
+      double rate = kmcMembers[ pair ].size() * kmcRates[ pair ];
+      kmcTreeAdd( pair, rate );
+   }
+}
+
+
+// Put the reaction instance of the given slot of the
+// position (x,y) into the class of the pair of reactants
+// it now brings together
+void
+Sim::kmcClassify( int x, int y, int slot )
+{
+   int64_t site = rowOffset[ y ] + colOffset[ x ];
+   int partnerIndex = rxnIndices;
+   if( slot != 0 )
+   {
+      int partnerX = x + rxndx[ slot ];
+      int partnerY = y + rxndy[ slot ];
+      if( partnerX < 0 )
+         partnerX += o->worldX;
+      else if( partnerX >= o->worldX )
+         partnerX -= o->worldX;
+      if( partnerY >= o->worldY )
+         partnerY -= o->worldY;
+      int64_t partner = rowOffset[ partnerY ] + colOffset[ partnerX ];
+
+      // A world one position wide or tall would make a
+      // position its own neighbor
+      if( partner == site )
+         partnerIndex = -1;
+      else
+         partnerIndex = lattice[ partner ];
+   }
+
+   int pair = 0;
+   if( partnerIndex >= 0 )
+      pair = rxnPairs[ lattice[ site ] * ( rxnIndices + 1 ) + partnerIndex ];
+
+   int instance = ( x + y * o->worldX ) * 5 + slot;
+   int oldPair = kmcClass[ instance ];
+   if( pair == oldPair )
+      return;
+
+   // Remove the instance from its old class by moving the
+   // last member into its place
+   if( oldPair != 0 )
+   {
+      std::vector<int>& members = kmcMembers[ oldPair ];
+      int last = members.back();
+      members[ kmcIndex[ instance ] ] = last;
+      kmcIndex[ last ] = kmcIndex[ instance ];
+      members.pop_back();
+      kmcTreeAdd( oldPair, -kmcRates[ oldPair ] );
+   }
+
+   if( pair != 0 )
+   {
+      kmcIndex[ instance ] = kmcMembers[ pair ].size();
+      kmcMembers[ pair ].push_back( instance );
+      kmcTreeAdd( pair, kmcRates[ pair ] );
+   }
+   kmcClass[ instance ] = pair;
+}
+
+
+// Reclassify every reaction instance involving the
+// position (x,y) after its species has changed: its own 5
+// slots, and the slots of the 4 neighbors that can reach
+// it; unless SECOND_ORDER is true, only its first-order
+// slot can hold a reaction
+template<bool SECOND_ORDER>
+void
+Sim::kmcUpdate( int x, int y )
+{
+   kmcClassify( x, y, 0 );
+   if( !SECOND_ORDER )
+      return;
+
+   for( int slot = 1; slot < 5; slot++ )
+      kmcClassify( x, y, slot );
+
+   for( int slot = 1; slot < 5; slot++ )
+   {
+      int sourceX = x - rxndx[ slot ];
+      int sourceY = y - rxndy[ slot ];
+      if( sourceX < 0 )
+         sourceX += o->worldX;
+      else if( sourceX >= o->worldX )
+         sourceX -= o->worldX;
+      if( sourceY < 0 )
+         sourceY += o->worldY;
+      kmcClassify( sourceX, sourceY, slot );
+   }
+}
+
+
+// Add the position at world index w to the list of atoms,
+// or remove it, according to whether it holds an atom
+void
+Sim::kmcSyncAtom( int w )
+{
+   if( world[ w ] != NULL && kmcAtomIndex[ w ] < 0 )
+   {
+      kmcAtomIndex[ w ] = kmcAtoms.size();
+      kmcAtoms.push_back( w );
+   }
+   else if( world[ w ] == NULL && kmcAtomIndex[ w ] >= 0 )
+   {
+      int last = kmcAtoms.back();
+      kmcAtoms[ kmcAtomIndex[ w ] ] = last;
+      kmcAtomIndex[ last ] = kmcAtomIndex[ w ];
+      kmcAtomIndex[ w ] = -1;
+      kmcAtoms.pop_back();
+   }
+}
+
+
+// Add delta to the total rate of the class of pair in the
+// Fenwick tree of class rates, and to the total rate of
+// reactions
+void
+Sim::kmcTreeAdd( int pair, double delta )
+{
+   for( unsigned int i = pair + 1; i < kmcTree.size(); i += i & -i )
+      kmcTree[ i ] += delta;
+   kmcRxnRate += delta;
+}
+
+
+// Returns the class whose share of the total rate of
+// reactions contains target, where the classes are laid
+// end to end in order
+int
+Sim::kmcTreeFind( double target )
+{
+   int n = kmcTree.size() - 1;
+   int step = 1;
+   while( step * 2 <= n )
+      step *= 2;
+
+   int i = 0;
+   for( ; step > 0; step /= 2 )
+   {
+      if( i + step <= n && kmcTree[ i + step ] <= target )
+      {
+         i += step;
+         target -= kmcTree[ i ];
+      }
+   }
+
+   // Tree entry i+1 is the class i
+   return i;
+}
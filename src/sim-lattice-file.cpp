@@ -0,0 +1,169 @@
+/* sim-lattice-file.cpp
+ */
+
+#include <cerrno>  // errno
+#include <cstdlib> // exit
+#include <cstring> // memcpy, memset, strerror, strncpy
+#include <iostream>
+#if defined( BLR_USELINUX ) || defined( BLR_USEMAC )
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, msync, munmap
+#include <unistd.h>   // close, ftruncate, sysconf
+#endif
+#include "sim.h"
+
+
+// Create the lattice file named by --lattice-file, or reuse
+// it at its new size, map it into memory, and describe the
+// world in its header; returns the lattice, which follows
+// the header on a page boundary.  The statistics of the
+// atoms follow the lattice if they are kept.  The lattice
+// is marked as changing until the atoms have been placed.
+uint8_t*
+Sim::mapLatticeFile()
+{
+#if defined( BLR_USELINUX ) || defined( BLR_USEMAC )
+   int64_t pageSize = sysconf( _SC_PAGESIZE );
+   int64_t latticeOffset = ( (int64_t)sizeof( LatticeFileHeader ) + pageSize - 1 ) / pageSize * pageSize;
+   int64_t statsOffset = 0;
+   latticeFileSize = latticeOffset + latticeSize;
+   if( o->doDiffusion && !o->lean )
+   {
+      statsOffset = ( latticeFileSize + 7 ) / 8 * 8;
+      latticeFileSize = statsOffset + (int64_t)o->worldX * o->worldY * sizeof( LatticeFileStats );
+   }
+
+   // The file is not truncated first, so that a reader that
+   // has it mapped keeps its pages when a world of the same
+   // size is built again
+   int fd = open( o->latticePath.c_str(), O_RDWR | O_CREAT, 0644 );
+   if( fd < 0 )
+   {
+      std::cerr << "Error: Unable to open lattice file " << o->latticePath << ": " << strerror( errno ) << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   if( ftruncate( fd, latticeFileSize ) != 0 )
+   {
+      std::cerr << "Error: Unable to resize lattice file " << o->latticePath << ": " << strerror( errno ) << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   void* region = mmap( NULL, latticeFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+   close( fd );
+   if( region == MAP_FAILED )
+   {
+      std::cerr << "Error: Unable to map lattice file " << o->latticePath << ": " << strerror( errno ) << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   latticeFile = (LatticeFileHeader*)region;
+
+   // Describe the world
+   std::memset( (void*)latticeFile, 0, sizeof( LatticeFileHeader ) );
+   latticeFile->sequence = 1;
+   std::memcpy( latticeFile->magic, LATTICE_FILE_MAGIC, sizeof( LATTICE_FILE_MAGIC ) );
+   latticeFile->version = LATTICE_FILE_VERSION;
+   latticeFile->headerSize = sizeof( LatticeFileHeader );
+   latticeFile->worldX = o->worldX;
+   latticeFile->worldY = o->worldY;
+   latticeFile->tileW = tileW;
+   latticeFile->tileH = tileH;
+   latticeFile->latticeOffset = latticeOffset;
+   latticeFile->latticeSize = latticeSize;
+   latticeFile->statsOffset = statsOffset;
+   latticeFile->iteration = itersCompleted;
+
+   // The species are listed by their index in the lattice;
+   // names and colors that do not fit are cut short
+   latticeFile->nSpecies = elementsByIndex.size();
+   for( unsigned int i = 0; i < elementsByIndex.size(); i++ )
+   {
+      Element* ele = elementsByIndex[ i ];
+      if( ele == NULL )
+         continue;
+      LatticeFileSpecies& species = latticeFile->species[ i ];
+      std::strncpy( species.name, ele->getName().c_str(), LATTICE_FILE_NAME_LENGTH - 1 );
+      species.symbol = ele->getSymbol();
+      std::strncpy( species.color, ele->getColor().c_str(), LATTICE_FILE_COLOR_LENGTH - 1 );
+   }
+
+   return (uint8_t*)region + latticeOffset;
+#else
+   std::cerr << "Error: --lattice-file is not supported on this system" << std::endl;
+   exit( EXIT_FAILURE );
+#endif
+}
+
+
+// Mark the lattice in the lattice file as changing; the
+// sequence becomes odd
+void
+Sim::beginLatticeFileUpdate()
+{
+   if( latticeFile == NULL || ( latticeFile->sequence & 1 ) )
+      return;
+
+   latticeFile->sequence++;
+   __sync_synchronize();
+}
+
+
+// Mark the lattice in the lattice file as settled after
+// itersCompleted iterations; the sequence becomes even
+void
+Sim::endLatticeFileUpdate()
+{
+   if( latticeFile == NULL || !( latticeFile->sequence & 1 ) )
+      return;
+
+   latticeFile->iteration = itersCompleted;
+   __sync_synchronize();
+   latticeFile->sequence++;
+}
+
+
+// Fill in the statistics of the atoms, if they are kept,
+// and write the whole file out to disk
+void
+Sim::syncLatticeFile()
+{
+   if( latticeFile == NULL )
+      return;
+
+   if( latticeFile->statsOffset != 0 )
+   {
+      LatticeFileStats* stats = (LatticeFileStats*)( (char*)latticeFile + latticeFile->statsOffset );
+      std::memset( stats, 0, (int64_t)o->worldX * o->worldY * sizeof( LatticeFileStats ) );
+      for( int y = 0; y < o->worldY; y++ )
+      {
+         for( int x = 0; x < o->worldX; x++ )
+         {
+            Atom* thisAtom = world[ getWorldIndex(x,y) ];
+            if( thisAtom == NULL )
+               continue;
+            LatticeFileStats& atomStats = stats[ x + (int64_t)y * o->worldX ];
+            atomStats.dxActual = thisAtom->dx_actual;
+            atomStats.dyActual = thisAtom->dy_actual;
+            atomStats.dxIdeal = thisAtom->dx_ideal;
+            atomStats.dyIdeal = thisAtom->dy_ideal;
+            atomStats.collisions = thisAtom->collisions;
+         }
+      }
+   }
+
+#if defined( BLR_USELINUX ) || defined( BLR_USEMAC )
+   msync( latticeFile, latticeFileSize, MS_SYNC );
+#endif
+}
+
+
+// Unmap the lattice file, which is left on disk
+void
+Sim::unmapLatticeFile()
+{
+   if( latticeFile == NULL )
+      return;
+
+#if defined( BLR_USELINUX ) || defined( BLR_USEMAC )
+   munmap( latticeFile, latticeFileSize );
+#endif
+   latticeFile = NULL;
+}
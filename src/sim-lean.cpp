@@ -0,0 +1,217 @@
+/* sim-lean.cpp
+ */
+
+#include <cstring> // memset
+#include "sim.h"
+
+
+// Move the atoms of a lean world with the bitplane engine.
+// The random numbers are drawn a band of rows at a time as
+// the planes are packed, since the planes hold all that
+// the later stages need of them.
+void
+Sim::leanMoveAtoms()
+{
+   for( int y = 0; y < o->worldY; y++ )
+   {
+      if( ( y & randRowMask ) == 0 )
+         generateRandNums();
+      packPlanesRow( y );
+   }
+
+   for( int y = 0; y < o->worldY; y++ )
+      findSinglyClaimedRow( y );
+
+   for( int y = 0; y < o->worldY; y++ )
+      leanMoveAtomsRow( y );
+}
+
+
+// Move every atom in row y that can move; with no Atoms
+// there are no statistics to keep for those that collide
+void
+Sim::leanMoveAtomsRow( int y )
+{
+   uint64_t* movable = planeRows[2];
+   findMovableRow( y, movable );
+
+   const uint64_t* dir[3];
+   for( int k = 0; k < 3; k++ )
+      dir[k] = dirPlanes + ( k * o->worldY + y ) * planeWords;
+
+   for( int w = 0; w < planeWords; w++ )
+   {
+      uint64_t atoms = movable[w];
+      while( atoms != 0 )
+      {
+         int i = __builtin_ctzll( atoms );
+         int atomDir = ( ( dir[0][w] >> i ) & 1 ) | ( ( ( dir[1][w] >> i ) & 1 ) << 1 ) | ( ( ( dir[2][w] >> i ) & 1 ) << 2 );
+         int x = w * 64 + i;
+         int destX = x + dirdx[ atomDir ];
+         int destY = y + dirdy[ atomDir ];
+         if( destX < 0 )
+            destX += o->worldX;
+         else if( destX >= o->worldX )
+            destX -= o->worldX;
+         if( destY < 0 )
+            destY += o->worldY;
+         else if( destY >= o->worldY )
+            destY -= o->worldY;
+
+         int64_t site = rowOffset[y] + colOffset[x];
+         lattice[ rowOffset[destY] + colOffset[destX] ] = lattice[ site ];
+         lattice[ site ] = 0;
+         atoms &= atoms - 1;
+      }
+   }
+}
+
+
+// Scan a lean world, check for potential reactions, and
+// execute some of them, with the same rules as executeRxns.
+// The random numbers are drawn a band of rows at a time, so
+// the attempts are found and claimed row by row; since an
+// attempt claims only its own row and the row below, the
+// attempts of row y-1 are settled as soon as those of row
+// y have been claimed, except that those of row 0 wait for
+// the last row.  The claims are counted up to two in
+// occupancyPlane and singlyClaimedPlane.
+template<bool SECOND_ORDER>
+void
+Sim::leanExecuteRxns()
+{
+   if( SECOND_ORDER )
+   {
+      std::memset( occupancyPlane, 0, planeWords * o->worldY * sizeof( uint64_t ) );
+      std::memset( singlyClaimedPlane, 0, planeWords * o->worldY * sizeof( uint64_t ) );
+   }
+
+   rxnAttempts.clear();
+   unsigned int rowZeroEnd = 0;
+   for( int y = 0; y < o->worldY; y++ )
+   {
+      unsigned int start = rxnAttempts.size();
+      if( ( y & randRowMask ) == 0 )
+         generateRandNums();
+      if( rxnSkipShift > 0 )
+         findRxnAttemptsSkipRow<SECOND_ORDER>( y );
+      else
+         forEachSegmentInRow( &Sim::findRxnAttemptsSegment<SECOND_ORDER>, y );
+
+      if( !SECOND_ORDER )
+      {
+         leanResolveRxnAttempts<SECOND_ORDER>( start, rxnAttempts.size() );
+         rxnAttempts.clear();
+         continue;
+      }
+
+      for( unsigned int i = start; i < rxnAttempts.size(); i++ )
+      {
+         leanClaimPosition( rxnAttempts[i].x, rxnAttempts[i].y );
+         if( rxnAttempts[i].slot != 0 )
+            leanClaimPosition( rxnAttempts[i].x + rxndx[ rxnAttempts[i].slot ], rxnAttempts[i].y + rxndy[ rxnAttempts[i].slot ] );
+      }
+
+      if( y == 0 )
+      {
+         rowZeroEnd = rxnAttempts.size();
+      }
+      else if( y >= 2 )
+      {
+         leanResolveRxnAttempts<SECOND_ORDER>( rowZeroEnd, start );
+         rxnAttempts.erase( rxnAttempts.begin() + rowZeroEnd, rxnAttempts.begin() + start );
+      }
+   }
+
+   // Settle the last row, then row 0
+   if( SECOND_ORDER )
+   {
+      leanResolveRxnAttempts<SECOND_ORDER>( rowZeroEnd, rxnAttempts.size() );
+      leanResolveRxnAttempts<SECOND_ORDER>( 0, rowZeroEnd );
+   }
+}
+
+
+// The variant is chosen by selectEngine in sim-engine.cpp
+template void Sim::leanExecuteRxns<true>();
+template void Sim::leanExecuteRxns<false>();
+
+
+// Stake one reaction claim on the position (x,y), which
+// may lie one step beyond the edges of the world
+inline void
+Sim::leanClaimPosition( int x, int y )
+{
+   if( x < 0 )
+      x += o->worldX;
+   else if( x >= o->worldX )
+      x -= o->worldX;
+   if( y >= o->worldY )
+      y -= o->worldY;
+
+   int64_t w = (int64_t)y * planeWords + x / 64;
+   uint64_t bit = (uint64_t)1 << ( x % 64 );
+   singlyClaimedPlane[w] |= occupancyPlane[w] & bit;
+   occupancyPlane[w] |= bit;
+}
+
+
+// Returns true if the position (x,y), which may lie one
+// step beyond the edges of the world, carries exactly one
+// reaction claim
+inline bool
+Sim::leanClaimedOnce( int x, int y )
+{
+   if( x < 0 )
+      x += o->worldX;
+   else if( x >= o->worldX )
+      x -= o->worldX;
+   if( y >= o->worldY )
+      y -= o->worldY;
+
+   int64_t w = (int64_t)y * planeWords + x / 64;
+   return ( ( occupancyPlane[w] & ~singlyClaimedPlane[w] ) >> ( x % 64 ) ) & 1;
+}
+
+
+// Execute those of the reaction attempts [begin, end)
+// that are uncontested
+template<bool SECOND_ORDER>
+void
+Sim::leanResolveRxnAttempts( unsigned int begin, unsigned int end )
+{
+   for( unsigned int i = begin; i < end; i++ )
+   {
+      RxnAttempt& attempt = rxnAttempts[i];
+      if( !SECOND_ORDER ||
+          ( leanClaimedOnce( attempt.x, attempt.y ) &&
+            leanClaimedOnce( attempt.x + rxndx[ attempt.slot ], attempt.y + rxndy[ attempt.slot ] ) ) )
+         leanExecuteRxn( attempt );
+   }
+}
+
+
+// Execute a reaction that has passed the probability
+// test and has no competing claims
+void
+Sim::leanExecuteRxn( RxnAttempt& attempt )
+{
+   ElementVector products = attempt.rxn->getProducts();
+   leanSetPosition( attempt.site, products[0] );
+   if( attempt.slot != 0 )
+      leanSetPosition( attempt.partner, products[1] );
+}
+
+
+// Put an atom of Element ele at index i of the lattice in
+// place of whatever was there, keeping the counts of both
+// Elements; Solvent is left uncounted, as in the world
+inline void
+Sim::leanSetPosition( int64_t i, Element* ele )
+{
+   if( lattice[ i ] != 0 )
+      elementsByIndex[ lattice[ i ] ]->count--;
+   lattice[ i ] = ele->getIndex();
+   if( lattice[ i ] != 0 )
+      ele->count++;
+}
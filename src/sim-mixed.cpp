@@ -0,0 +1,192 @@
+/* sim-mixed.cpp
+ */
+
+#include <algorithm> // min
+#include <cmath> // exp, ldexp, lgamma, log, log1p, pow
+#include "sim.h"
+
+
+// Advance a shuffled world by one iteration without the
+// world itself.  Shuffling leaves every atom equally likely
+// to be anywhere, so each position holds an atom of Element
+// c with probability n_c / N, where the empty positions
+// count as Solvent, and the attempts of all the positions
+// holding one Element can be drawn together: as in
+// findRxnAttempt, a position attempts a first-order
+// reaction with probability 1/5 and otherwise picks a
+// neighbor, which holds each Element in proportion to its
+// numbers, and a channel.  An attempt that passes goes
+// ahead only if no other attempt claims either of its
+// positions, as in resolveRxnAttempts.  A position holding
+// Element a is claimed by each of the 4 neighbors that can
+// attempt to react with it with probability
+//
+//   h_a = 1/5 sum_c n_c / N pass(c,a)
+//
+// and, as the neighbor of a second-order attempt, by an
+// attempt of its own with probability
+//
+//   g_a = 1/5 ( pass(a) + 4 sum_c n_c / N pass(a,c) )
+//
+// so that a first-order attempt of Element a goes ahead
+// with probability (1-h_a)^4, and a second-order attempt
+// of a on b with (1-h_a)^4 (1-g_b) (1-h_b)^3.  Positions
+// are taken to be independent of one another, which the
+// moves made since the shuffle keep them very nearly.
+void
+Sim::mixedAdvance()
+{
+   if( !o->doRxns )
+      return;
+
+   const int nIndices = rxnIndices;
+   double nPositions = (double)o->worldX * (double)o->worldY;
+
+   // Count the positions holding each Element
+   std::vector<int64_t> counts( nIndices );
+   counts[0] = (int64_t)o->worldX * o->worldY;
+   for( int c = 1; c < nIndices; c++ )
+   {
+      counts[c] = elementsByIndex[c]->count;
+      counts[0] -= counts[c];
+   }
+
+   // Find the chance that a position holding each Element
+   // is not claimed by any other attempt, as the site of an
+   // attempt and as its neighbor
+   std::vector<double> siteClear( nIndices );
+   std::vector<double> partnerClear( nIndices );
+   for( int a = 0; a < nIndices; a++ )
+   {
+      double h = 0;
+      double g = 0;
+      for( int c = 0; c < nIndices; c++ )
+      {
+         h += counts[c] * mixedPass[ c * ( nIndices + 1 ) + a ];
+         g += counts[c] * mixedPass[ a * ( nIndices + 1 ) + c ];
+      }
+      h /= 5 * nPositions;
+      g = ( mixedPass[ a * ( nIndices + 1 ) + nIndices ] + 4 * g / nPositions ) / 5;
+      siteClear[a] = pow( 1 - h, 4 );
+      partnerClear[a] = ( 1 - g ) * pow( 1 - h, 3 );
+   }
+
+   // Draw the attempts of the positions holding each Element
+   // from a multinomial distribution, one outcome at a time,
+   // and carry out those that go ahead; no position takes
+   // part in more than one reaction, so at most the
+   // positions not yet used this iteration can react
+   std::vector<int64_t> available( counts );
+   for( int a = 0; a < nIndices; a++ )
+   {
+      int64_t remaining = counts[a];
+      double remainingProb = 1;
+      for( int b = 0; b <= nIndices && remaining > 0; b++ )
+      {
+         int pair = rxnPairs[ a * ( nIndices + 1 ) + b ];
+         if( pair == 0 )
+            continue;
+
+         // The chance of attempting the pair, and of an
+         // attempt on it that passes going ahead
+         double share;
+         double clear;
+         if( b == nIndices )
+         {
+            share = 0.2;
+            clear = siteClear[a];
+         }
+         else
+         {
+            share = 0.8 * ( counts[b] - ( a == b ? 1 : 0 ) ) / ( nPositions - 1 );
+            clear = siteClear[a] * partnerClear[b];
+         }
+         if( share <= 0 )
+            continue;
+
+         for( int channel = 0; channel < rxnPairChannels[ pair ] && remaining > 0; channel++ )
+         {
+            int entry = rxnPairEntries[ pair ] + channel;
+            if( rxnThresholds[ entry ] == 0 )
+               continue;
+            double p = share * ldexp( (double)rxnThresholds[ entry ], -61 ) / rxnPairChannels[ pair ];
+            int64_t passed = sampleBinomial( remaining, std::min( 1.0, p / remainingProb ) );
+            remaining -= passed;
+            remainingProb -= p;
+
+            int64_t executed = sampleBinomial( passed, clear );
+            if( b == nIndices )
+               executed = std::min( executed, available[a] );
+            else if( a == b )
+               executed = std::min( executed, available[a] / 2 );
+            else
+               executed = std::min( executed, std::min( available[a], available[b] ) );
+            if( executed == 0 )
+               continue;
+            available[a] -= executed;
+            if( b != nIndices )
+               available[b] -= executed;
+
+            // Solvent is left uncounted, as in the world
+            ElementVector reactants = rxnChoices[ entry ]->getReactants();
+            ElementVector products = rxnChoices[ entry ]->getProducts();
+            for( unsigned int j = 0; j < reactants.size(); j++ )
+               if( reactants[j]->getIndex() != 0 )
+                  reactants[j]->count -= executed;
+            for( unsigned int j = 0; j < products.size(); j++ )
+               if( products[j]->getIndex() != 0 )
+                  products[j]->count += executed;
+         }
+      }
+   }
+}
+
+
+// Returns a number drawn from the binomial distribution of
+// n trials with probability p, by inversion, summing the
+// probabilities outward from the mode so that the expected
+// number of terms grows only as the square root of the
+// variance
+int64_t
+Sim::sampleBinomial( int64_t n, double p )
+{
+   if( n <= 0 || p <= 0 )
+      return 0;
+   if( p >= 1 )
+      return n;
+
+   int64_t mode = (int64_t)( ( n + 1 ) * p );
+   if( mode > n )
+      mode = n;
+   double ratio = p / ( 1 - p );
+   double modeProb = exp( lgamma( n + 1.0 ) - lgamma( mode + 1.0 ) - lgamma( n - mode + 1.0 ) +
+                          mode * log( p ) + ( n - mode ) * log1p( -p ) );
+
+   double u = nextUniform() - modeProb;
+   int64_t lo = mode;
+   int64_t hi = mode;
+   double loProb = modeProb;
+   double hiProb = modeProb;
+   while( u > 0 )
+   {
+      // Rounding errors can leave a little probability
+      // unaccounted for, which is given to the mode
+      if( lo == 0 && hi == n )
+         return mode;
+      if( hi < n )
+      {
+         hiProb *= ratio * ( n - hi ) / ( hi + 1 );
+         hi++;
+         u -= hiProb;
+         if( u <= 0 )
+            return hi;
+      }
+      if( lo > 0 )
+      {
+         loProb *= lo / ( ratio * ( n - lo + 1 ) );
+         lo--;
+         u -= loProb;
+      }
+   }
+   return lo;
+}
@@ -0,0 +1,441 @@
+/* sim-mpi.cpp
+ */
+
+#ifdef HAVE_MPI
+
+#include <algorithm> // min
+#include <cstdlib> // exit
+#include <iostream>
+#include "sim.h"
+
+
+// Split the world into slabs of rows, one for each rank,
+// and give this rank a world of its own that holds its
+// slab followed by the halo rows copied from its
+// neighbors: rows slabRows and slabRows+1 stand for the
+// first 2 rows of the rank below, and the last 2 rows,
+// which the slab wraps around onto, for the last 2 rows of
+// the rank above.  The engine kernels then run unchanged
+// on the world of the rank, and only the halo rows need to
+// be exchanged.
+void
+Sim::mpiInit()
+{
+   MPI_Comm_rank( MPI_COMM_WORLD, &mpiRank );
+   MPI_Comm_size( MPI_COMM_WORLD, &mpiRanks );
+
+   // Every rank must start from the seed of the first,
+   // which may have been taken from the clock
+   MPI_Bcast( &o->seed, 1, MPI_INT, 0, MPI_COMM_WORLD );
+
+   // Only the first rank reports progress
+   if( mpiRank != 0 )
+   {
+      o->progress = false;
+      o->verbose = false;
+   }
+
+   if( mpiRanks == 1 )
+      return;
+
+   // Only the synchronous engines are split into slabs
+   if( o->doShuffle || o->doKMC || o->doFused || o->doBitplanes || o->lean || o->ssa != Options::SSA_OFF || o->doWellMixed )
+   {
+      if( mpiRank == 0 )
+         std::cerr << "mpiInit: --shuffle, --kmc, --fused, --bitplanes, --lean, --ssa and --well-mixed cannot be used with more than one rank!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   if( o->latticePath != "" || o->autotune )
+   {
+      if( mpiRank == 0 )
+         std::cerr << "mpiInit: --lattice-file and --autotune cannot be used with more than one rank!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   if( o->worldY < MPI_HALO_ROWS * mpiRanks )
+   {
+      if( mpiRank == 0 )
+         std::cerr << "mpiInit: the world must be at least " << MPI_HALO_ROWS << " rows high for each rank!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   o->gui = Options::GUI_OFF;
+
+   // Divide the rows as evenly as possible
+   worldRows = o->worldY;
+   slabRows = worldRows / mpiRanks + ( mpiRank < worldRows % mpiRanks ? 1 : 0 );
+   slabY = mpiRank * ( worldRows / mpiRanks ) + std::min( mpiRank, worldRows % mpiRanks );
+   o->worldY = slabRows + 2 * MPI_HALO_ROWS;
+}
+
+
+// Shorten the run on every rank to the shortest of any
+// rank, since any one of them can be told to end early
+void
+Sim::mpiAgreeOnEnd()
+{
+   if( mpiRanks > 1 )
+      MPI_Allreduce( MPI_IN_PLACE, &o->maxIters, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD );
+}
+
+
+// Sum the numbers of atoms of each Element over every rank
+// for the census
+void
+Sim::mpiReduceCounts()
+{
+   std::vector<int64_t> counts( elementsByIndex.size(), 0 );
+   for( unsigned int i = 0; i < elementsByIndex.size(); i++ )
+      counts[i] = elementsByIndex[i]->count;
+   mpiCounts.resize( counts.size() );
+   MPI_Allreduce( &counts[0], &mpiCounts[0], counts.size(), MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD );
+}
+
+
+// Returns the number of atoms that the slab starts with in
+// position set set, for an Element with starting
+// concentration conc: the atoms that the whole world would
+// start with are shared among the slabs in proportion to
+// their rows, so that every Element starts with as many
+// atoms however many ranks there are
+int64_t
+Sim::mpiShareOfAtoms( double conc, int set )
+{
+   int nSets = maxPositions.size();
+   long long worldPositions = (long long)o->worldX * worldRows;
+   long long setPositions = worldPositions / nSets + ( set < worldPositions % nSets ? 1 : 0 );
+   long long total = (long long)( conc * setPositions + 0.5 );
+   long long share = total * ( slabY + slabRows ) / worldRows - total * slabY / worldRows;
+   if( share > maxPositions[ set ] )
+      share = maxPositions[ set ];
+   return share;
+}
+
+
+// Move Atoms in the slab and handle collisions.  The claims
+// on the first and last rows of the slab depend on the
+// move intents of the 2 rows beyond them, which are copied
+// from the neighbors; atoms that move off the slab into
+// the halo rows are then handed over to the neighbors, who
+// judge the same moves from the same intents.
+template<bool STATS>
+void
+Sim::mpiMoveAtoms()
+{
+   forEachSegment( &Sim::findMoveIntentsSegment );
+   mpiExchangeRows( moveDirBits, MPI_HALO_ROWS );
+   forEachSegment( &Sim::countMoveClaimsSegment );
+
+   // The atoms of the halo rows belong to the neighbors
+   for( int y = slabRows; y < o->worldY; y++ )
+      for( int x = 0; x < o->worldX; x++ )
+         moveDirBits[ rowOffset[y] + colOffset[x] ] = 0;
+   forEachSegment( &Sim::moveAtomsSegment<STATS> );
+
+   // Hand over the atoms that moved off the top of the slab
+   // to the rank above, where they arrive in its last row,
+   // and those that moved off the bottom to the rank below
+   int up = ( mpiRank + mpiRanks - 1 ) % mpiRanks;
+   int down = ( mpiRank + 1 ) % mpiRanks;
+   mpiSendAtoms( o->worldY - 1, up, down, slabRows - 1 );
+   mpiSendAtoms( slabRows, down, up, 0 );
+}
+
+
+// The variant is chosen by selectEngine in sim-engine.cpp
+template void Sim::mpiMoveAtoms<true>();
+template void Sim::mpiMoveAtoms<false>();
+
+
+// Scan the slab, check for potential reactions, and execute
+// some of them.  An attempt in the last row of the slab
+// can react with an atom in the first row of the rank
+// below, which is copied in for the reaction to work on
+// and sent back afterwards, and the claims staked on that
+// row by either rank are summed by both.
+template<bool TRACKING, bool SECOND_ORDER>
+void
+Sim::mpiExecuteRxns()
+{
+   mpiImportRow();
+
+   rxnAttempts.clear();
+   for( int y = 0; y < slabRows; y++ )
+   {
+      if( rxnSkipShift > 0 )
+         findRxnAttemptsSkipRow<SECOND_ORDER>( y );
+      else
+         forEachSegmentInRow( &Sim::findRxnAttemptsSegment<SECOND_ORDER>, y );
+   }
+
+   if( SECOND_ORDER )
+   {
+      nextRxnClaimsEpoch();
+      claimRxnAttempts( 0, rxnAttempts.size() );
+      mpiExchangeClaims();
+   }
+   resolveRxnAttempts<TRACKING,SECOND_ORDER>( 0, rxnAttempts.size() );
+
+   mpiExportRow();
+}
+
+
+// The variant is chosen by selectEngine in sim-engine.cpp
+template void Sim::mpiExecuteRxns<true,true>();
+template void Sim::mpiExecuteRxns<true,false>();
+template void Sim::mpiExecuteRxns<false,true>();
+template void Sim::mpiExecuteRxns<false,false>();
+
+
+// Copy the first nRows rows of plane to the rank above and
+// the last nRows rows to the rank below, filling the halo
+// rows of plane with those of the neighbors
+void
+Sim::mpiExchangeRows( uint8_t* plane, int nRows )
+{
+   int up = ( mpiRank + mpiRanks - 1 ) % mpiRanks;
+   int down = ( mpiRank + 1 ) % mpiRanks;
+   int n = nRows * o->worldX;
+   std::vector<uint8_t> sendBuf( n );
+   std::vector<uint8_t> recvBuf( n );
+
+   // The first rows of the slab are the lower halo rows of
+   // the rank above
+   for( int r = 0; r < nRows; r++ )
+      for( int x = 0; x < o->worldX; x++ )
+         sendBuf[ r * o->worldX + x ] = plane[ rowOffset[ r ] + colOffset[x] ];
+   MPI_Sendrecv( &sendBuf[0], n, MPI_UNSIGNED_CHAR, up, 0,
+                 &recvBuf[0], n, MPI_UNSIGNED_CHAR, down, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+   for( int r = 0; r < nRows; r++ )
+      for( int x = 0; x < o->worldX; x++ )
+         plane[ rowOffset[ slabRows + r ] + colOffset[x] ] = recvBuf[ r * o->worldX + x ];
+
+   // The last rows of the slab are the upper halo rows of
+   // the rank below
+   for( int r = 0; r < nRows; r++ )
+      for( int x = 0; x < o->worldX; x++ )
+         sendBuf[ r * o->worldX + x ] = plane[ rowOffset[ slabRows - nRows + r ] + colOffset[x] ];
+   MPI_Sendrecv( &sendBuf[0], n, MPI_UNSIGNED_CHAR, down, 1,
+                 &recvBuf[0], n, MPI_UNSIGNED_CHAR, up, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+   for( int r = 0; r < nRows; r++ )
+      for( int x = 0; x < o->worldX; x++ )
+         plane[ rowOffset[ o->worldY - nRows + r ] + colOffset[x] ] = recvBuf[ r * o->worldX + x ];
+}
+
+
+// Send the atoms in row fromRow to rank dest, removing them
+// from this rank, and place the atoms received from rank
+// source in row toRow
+void
+Sim::mpiSendAtoms( int fromRow, int dest, int source, int toRow )
+{
+   const int fields = 8;
+   std::vector<int> sendBuf;
+   for( int x = 0; x < o->worldX; x++ )
+   {
+      Atom* thisAtom = world[ x + (int64_t)fromRow * o->worldX ];
+      if( thisAtom != NULL )
+      {
+         sendBuf.push_back( x );
+         sendBuf.push_back( thisAtom->getType()->getIndex() );
+         sendBuf.push_back( thisAtom->isTracked() );
+         sendBuf.push_back( thisAtom->dx_actual );
+         sendBuf.push_back( thisAtom->dy_actual );
+         sendBuf.push_back( thisAtom->dx_ideal );
+         sendBuf.push_back( thisAtom->dy_ideal );
+         sendBuf.push_back( thisAtom->collisions );
+         delete thisAtom;
+         world[ x + (int64_t)fromRow * o->worldX ] = NULL;
+      }
+      lattice[ rowOffset[ fromRow ] + colOffset[x] ] = 0;
+   }
+
+   int sendCount = sendBuf.size();
+   int recvCount = 0;
+   MPI_Sendrecv( &sendCount, 1, MPI_INT, dest, 2,
+                 &recvCount, 1, MPI_INT, source, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+   std::vector<int> recvBuf( recvCount + 1 );
+   sendBuf.push_back( 0 );
+   MPI_Sendrecv( &sendBuf[0], sendCount, MPI_INT, dest, 3,
+                 &recvBuf[0], recvCount, MPI_INT, source, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+
+   for( int i = 0; i < recvCount; i += fields )
+   {
+      int x = recvBuf[ i ];
+      Atom* thisAtom = new Atom( elementsByIndex[ recvBuf[ i + 1 ] ], x, toRow );
+      thisAtom->setTracked( recvBuf[ i + 2 ] != 0 );
+      thisAtom->dx_actual = recvBuf[ i + 3 ];
+      thisAtom->dy_actual = recvBuf[ i + 4 ];
+      thisAtom->dx_ideal = recvBuf[ i + 5 ];
+      thisAtom->dy_ideal = recvBuf[ i + 6 ];
+      thisAtom->collisions = recvBuf[ i + 7 ];
+      world[ x + (int64_t)toRow * o->worldX ] = thisAtom;
+      lattice[ rowOffset[ toRow ] + colOffset[x] ] = thisAtom->getType()->getIndex();
+   }
+}
+
+
+// Copy the first row of the slab to the rank above, and
+// fill row slabRows with atoms copied from the first row
+// of the rank below, for the reactions of the last row of
+// the slab
+void
+Sim::mpiImportRow()
+{
+   int up = ( mpiRank + mpiRanks - 1 ) % mpiRanks;
+   int down = ( mpiRank + 1 ) % mpiRanks;
+   int n = 2 * o->worldX;
+   std::vector<uint8_t> sendBuf( n );
+   std::vector<uint8_t> recvBuf( n );
+
+   for( int x = 0; x < o->worldX; x++ )
+   {
+      Atom* thisAtom = world[ x ];
+      sendBuf[ 2 * x ] = lattice[ rowOffset[0] + colOffset[x] ];
+      sendBuf[ 2 * x + 1 ] = ( thisAtom != NULL && thisAtom->isTracked() );
+   }
+   MPI_Sendrecv( &sendBuf[0], n, MPI_UNSIGNED_CHAR, up, 4,
+                 &recvBuf[0], n, MPI_UNSIGNED_CHAR, down, 4, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+
+   for( int x = 0; x < o->worldX; x++ )
+   {
+      if( recvBuf[ 2 * x ] != 0 )
+      {
+         Atom* thisAtom = new Atom( elementsByIndex[ recvBuf[ 2 * x ] ], x, slabRows );
+         thisAtom->setTracked( recvBuf[ 2 * x + 1 ] != 0 );
+         world[ x + (int64_t)slabRows * o->worldX ] = thisAtom;
+         lattice[ rowOffset[ slabRows ] + colOffset[x] ] = recvBuf[ 2 * x ];
+      }
+   }
+}
+
+
+// Sum the reaction claims staked on the first row of each
+// slab by its own rank and by the rank above, and give both
+// ranks the totals
+void
+Sim::mpiExchangeClaims()
+{
+   int up = ( mpiRank + mpiRanks - 1 ) % mpiRanks;
+   int down = ( mpiRank + 1 ) % mpiRanks;
+   std::vector<uint8_t> sendBuf( o->worldX );
+   std::vector<uint8_t> recvBuf( o->worldX );
+
+   // A position holds rxnClaimsEpoch plus its number of
+   // claims, or anything else if it has none
+   for( int x = 0; x < o->worldX; x++ )
+   {
+      uint8_t c = claimed[ rowOffset[ slabRows ] + colOffset[x] ];
+      sendBuf[x] = ( ( c & ~0x7 ) == rxnClaimsEpoch ) ? c & 0x7 : 0;
+   }
+   MPI_Sendrecv( &sendBuf[0], o->worldX, MPI_UNSIGNED_CHAR, down, 5,
+                 &recvBuf[0], o->worldX, MPI_UNSIGNED_CHAR, up, 5, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+   for( int x = 0; x < o->worldX; x++ )
+   {
+      uint8_t& c = claimed[ rowOffset[0] + colOffset[x] ];
+      int count = ( ( c & ~0x7 ) == rxnClaimsEpoch ) ? c & 0x7 : 0;
+      c = rxnClaimsEpoch + count + recvBuf[x];
+      sendBuf[x] = count + recvBuf[x];
+   }
+   MPI_Sendrecv( &sendBuf[0], o->worldX, MPI_UNSIGNED_CHAR, up, 6,
+                 &recvBuf[0], o->worldX, MPI_UNSIGNED_CHAR, down, 6, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+   for( int x = 0; x < o->worldX; x++ )
+      claimed[ rowOffset[ slabRows ] + colOffset[x] ] = rxnClaimsEpoch + recvBuf[x];
+}
+
+
+// Send the positions of row slabRows changed by reactions
+// back to the rank below, apply the changes made by the
+// rank above to the first row of the slab, and remove the
+// copied atoms
+void
+Sim::mpiExportRow()
+{
+   int up = ( mpiRank + mpiRanks - 1 ) % mpiRanks;
+   int down = ( mpiRank + 1 ) % mpiRanks;
+
+   // Only a reaction that was executed, with a partner in
+   // the row below the slab, changes the row
+   std::vector<int> sendBuf;
+   for( unsigned int i = 0; i < rxnAttempts.size(); i++ )
+   {
+      RxnAttempt& attempt = rxnAttempts[i];
+      if( attempt.slot != 0 && attempt.y + rxndy[ attempt.slot ] == slabRows &&
+          claimed[ attempt.site ] == rxnClaimsEpoch + 1 &&
+          claimed[ attempt.partner ] == rxnClaimsEpoch + 1 )
+      {
+         int x = ( attempt.x + rxndx[ attempt.slot ] + o->worldX ) % o->worldX;
+         Atom* thisAtom = world[ x + (int64_t)slabRows * o->worldX ];
+         sendBuf.push_back( x );
+         sendBuf.push_back( thisAtom != NULL ? thisAtom->getType()->getIndex() : 0 );
+         sendBuf.push_back( thisAtom != NULL && thisAtom->isTracked() );
+      }
+   }
+
+   int sendCount = sendBuf.size();
+   int recvCount = 0;
+   MPI_Sendrecv( &sendCount, 1, MPI_INT, down, 7,
+                 &recvCount, 1, MPI_INT, up, 7, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+   std::vector<int> recvBuf( recvCount + 1 );
+   sendBuf.push_back( 0 );
+   MPI_Sendrecv( &sendBuf[0], sendCount, MPI_INT, down, 8,
+                 &recvBuf[0], recvCount, MPI_INT, up, 8, MPI_COMM_WORLD, MPI_STATUS_IGNORE );
+
+   for( int i = 0; i < recvCount; i += 3 )
+   {
+      int x = recvBuf[ i ];
+      int type = recvBuf[ i + 1 ];
+      Atom*& thisAtom = world[ x ];
+      if( type == 0 )
+      {
+         delete thisAtom;
+         thisAtom = NULL;
+      }
+      else
+      {
+         if( thisAtom == NULL )
+            thisAtom = new Atom( elementsByIndex[ type ], x, 0 );
+         else
+            thisAtom->setType( elementsByIndex[ type ] );
+         thisAtom->setTracked( recvBuf[ i + 2 ] != 0 );
+      }
+      lattice[ rowOffset[0] + colOffset[x] ] = type;
+   }
+
+   for( int x = 0; x < o->worldX; x++ )
+   {
+      delete world[ x + (int64_t)slabRows * o->worldX ];
+      world[ x + (int64_t)slabRows * o->worldX ] = NULL;
+      lattice[ rowOffset[ slabRows ] + colOffset[x] ] = 0;
+   }
+}
+
+
+// Write the diffusion data of every rank to the diffusion
+// file, each after those of the ranks above it
+void
+Sim::mpiWriteDiffusion( const std::string& text )
+{
+   long long length = text.size();
+   long long offset = 0;
+   MPI_Exscan( &length, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD );
+   if( mpiRank == 0 )
+      offset = 0;
+
+   // Some MPI implementations fail to open a bare file name
+   // of one character, so the directory is always given
+   std::string path = o->filePaths[ Options::FILE_DIFFUSION ];
+   if( path.find( '/' ) == std::string::npos )
+      path = "./" + path;
+
+   MPI_File file;
+   if( MPI_File_open( MPI_COMM_WORLD, (char*)path.c_str(),
+                      MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file ) != MPI_SUCCESS )
+   {
+      std::cerr << "mpiWriteDiffusion: unable to open file \"" << o->filePaths[ Options::FILE_DIFFUSION ] << "\"!" << std::endl;
+      exit( EXIT_FAILURE );
+   }
+   MPI_File_set_size( file, 0 );
+   MPI_File_write_at_all( file, offset, (void*)text.data(), length, MPI_CHAR, MPI_STATUS_IGNORE );
+   MPI_File_close( &file );
+}
+
+#endif /* HAVE_MPI */
@@ -0,0 +1,178 @@
+/* sim-numa.cpp
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#ifdef BLR_USELINUX
+#include <sched.h> // sched_getaffinity, sched_getcpu, sched_setaffinity
+#endif
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#include <numaif.h> // get_mempolicy
+#endif
+#include "sim.h"
+
+
+// Place the process as asked by --pin and --numa, before
+// the world is built.  Each MPI rank is the only process to
+// touch the buffers of its own slab, so they are placed on
+// the node it runs on once it stays there.  The ranks on
+// one host are spread over its CPUs, or over its nodes, in
+// blocks, so that the neighboring slabs that exchange rows
+// are placed close together.
+void
+Sim::placeProcess()
+{
+   placedCPU = -1;
+   placedNode = -1;
+   if( !o->pin && !o->numa )
+      return;
+
+   int localRank = 0;
+   int localRanks = 1;
+#ifdef HAVE_MPI
+   MPI_Comm local;
+   MPI_Comm_split_type( MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &local );
+   MPI_Comm_rank( local, &localRank );
+   MPI_Comm_size( local, &localRanks );
+   MPI_Comm_free( &local );
+#endif
+
+#ifdef BLR_USELINUX
+   if( o->pin )
+   {
+      // A single process stays on the CPU it started on
+      cpu_set_t allowed;
+      CPU_ZERO( &allowed );
+      sched_getaffinity( 0, sizeof( allowed ), &allowed );
+      int cpu = sched_getcpu();
+      if( localRanks > 1 || cpu < 0 )
+      {
+         int target = (int)( (int64_t)localRank * CPU_COUNT( &allowed ) / localRanks );
+         for( cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+            if( CPU_ISSET( cpu, &allowed ) && target-- == 0 )
+               break;
+      }
+
+      cpu_set_t pinned;
+      CPU_ZERO( &pinned );
+      CPU_SET( cpu, &pinned );
+      if( sched_setaffinity( 0, sizeof( pinned ), &pinned ) == 0 )
+         placedCPU = cpu;
+      else
+         std::cerr << "Warning: Unable to pin the process to CPU " << cpu << std::endl;
+   }
+#else
+   if( o->pin && mpiRank == 0 )
+      std::cerr << "Warning: --pin is not supported on this system" << std::endl;
+#endif
+
+   if( o->numa )
+   {
+#ifdef HAVE_LIBNUMA
+      if( numa_available() >= 0 )
+      {
+         // A pinned process keeps its memory on the node of its
+         // CPU; otherwise it is kept on its node with its memory
+         if( placedCPU >= 0 )
+         {
+            placedNode = numa_node_of_cpu( placedCPU );
+         }
+         else
+         {
+            placedNode = (int)( (int64_t)localRank * ( numa_max_node() + 1 ) / localRanks );
+            numa_run_on_node( placedNode );
+         }
+         numa_set_preferred( placedNode );
+      }
+      else if( mpiRank == 0 )
+      {
+         std::cerr << "Warning: NUMA is not available; memory is placed by first touch" << std::endl;
+      }
+#else
+      if( mpiRank == 0 )
+         std::cerr << "Warning: Compiled without libnuma; memory is placed by first touch" << std::endl;
+#endif
+   }
+}
+
+
+// Describe the placement in effect for printPlacement: the
+// CPUs the process may run on, the CPU and node it is
+// running on, and the node holding the lattice.  Under MPI
+// the descriptions of every rank are gathered by the first.
+void
+Sim::findPlacement()
+{
+   std::ostringstream line;
+   line << "placement rank " << mpiRank;
+
+#ifdef BLR_USELINUX
+   // List the allowed CPUs as ranges
+   cpu_set_t allowed;
+   CPU_ZERO( &allowed );
+   sched_getaffinity( 0, sizeof( allowed ), &allowed );
+   line << " cpus ";
+   std::string separator = "";
+   for( int cpu = 0; cpu < CPU_SETSIZE; cpu++ )
+   {
+      if( !CPU_ISSET( cpu, &allowed ) )
+         continue;
+      int last = cpu;
+      while( last + 1 < CPU_SETSIZE && CPU_ISSET( last + 1, &allowed ) )
+         last++;
+      line << separator << cpu;
+      if( last > cpu )
+         line << "-" << last;
+      separator = ",";
+      cpu = last;
+   }
+   int cpu = sched_getcpu();
+   line << " on cpu " << cpu;
+#endif
+
+#ifdef HAVE_LIBNUMA
+   if( numa_available() >= 0 )
+   {
+#ifdef BLR_USELINUX
+      line << " node " << numa_node_of_cpu( cpu );
+#endif
+      int node = -1;
+      if( lattice != NULL && get_mempolicy( &node, NULL, 0, lattice, MPOL_F_NODE | MPOL_F_ADDR ) == 0 )
+         line << " lattice on node " << node;
+      if( placedNode >= 0 )
+         line << " preferring node " << placedNode;
+      else
+         line << " first touch";
+   }
+#else
+   line << " first touch";
+#endif
+
+   placement.clear();
+#ifdef HAVE_MPI
+   if( mpiRanks > 1 )
+   {
+      const int LINE_LENGTH = 256;
+      std::string text = line.str();
+      text.resize( LINE_LENGTH - 1 );
+      std::vector<char> lines( mpiRank == 0 ? mpiRanks * LINE_LENGTH : 0 );
+      MPI_Gather( (void*)text.c_str(), LINE_LENGTH, MPI_CHAR, lines.empty() ? NULL : &lines[0], LINE_LENGTH, MPI_CHAR, 0, MPI_COMM_WORLD );
+      if( mpiRank == 0 )
+         for( int i = 0; i < mpiRanks; i++ )
+            placement.push_back( std::string( &lines[ i * LINE_LENGTH ] ) );
+      return;
+   }
+#endif
+   placement.push_back( line.str() );
+}
+
+
+// Print the placement found by findPlacement
+void
+Sim::printPlacement( std::ostream* out )
+{
+   for( unsigned int i = 0; i < placement.size(); i++ )
+      *out << placement[ i ] << std::endl;
+}
@@ -0,0 +1,131 @@
+/* sim-ode.cpp
+ */
+
+#include <algorithm> // max, min
+#include <cmath> // fabs, pow
+#include "sim.h"
+
+
+// Start the expected census from the atoms in the world
+// at the current iteration
+void
+Sim::odeInit()
+{
+   odeState.assign( rxnIndices, 0 );
+   for( int index = 0; index < rxnIndices; index++ )
+      odeState[ index ] = censusCount( elementsByIndex[ index ] );
+   odeTime = itersCompleted;
+   odeStep = 0.01;
+}
+
+
+// Integrate the rate laws from odeTime to end with the
+// Dormand-Prince pair of embedded Runge-Kutta methods of
+// orders 5 and 4, choosing each step so that the estimated
+// error stays within a relative and absolute tolerance.
+// The size of the last step taken is carried over to the
+// next call, so that an iteration usually takes one step.
+void
+Sim::odeAdvance( double end )
+{
+   static const double a21 = 1.0 / 5.0;
+   static const double a31 = 3.0 / 40.0, a32 = 9.0 / 40.0;
+   static const double a41 = 44.0 / 45.0, a42 = -56.0 / 15.0, a43 = 32.0 / 9.0;
+   static const double a51 = 19372.0 / 6561.0, a52 = -25360.0 / 2187.0, a53 = 64448.0 / 6561.0, a54 = -212.0 / 729.0;
+   static const double a61 = 9017.0 / 3168.0, a62 = -355.0 / 33.0, a63 = 46732.0 / 5247.0, a64 = 49.0 / 176.0, a65 = -5103.0 / 18656.0;
+   static const double b1 = 35.0 / 384.0, b3 = 500.0 / 1113.0, b4 = 125.0 / 192.0, b5 = -2187.0 / 6784.0, b6 = 11.0 / 84.0;
+   static const double e1 = 71.0 / 57600.0, e3 = -71.0 / 16695.0, e4 = 71.0 / 1920.0, e5 = -17253.0 / 339200.0, e6 = 22.0 / 525.0, e7 = -1.0 / 40.0;
+   static const double relTol = 1e-6;
+   static const double absTol = 1e-6;
+
+   int n = odeState.size();
+   std::vector<double> k1( n ), k2( n ), k3( n ), k4( n ), k5( n ), k6( n ), k7( n );
+   std::vector<double> stage( n ), next( n );
+
+   odeDerivatives( odeState, k1 );
+   while( odeTime < end )
+   {
+      // Do not step past the end of the iteration; the step
+      // that would have been taken is kept for the next one
+      double h = odeStep;
+      bool last = false;
+      if( odeTime + h >= end )
+      {
+         h = end - odeTime;
+         last = true;
+      }
+
+      for( int i = 0; i < n; i++ )
+         stage[i] = odeState[i] + h * ( a21 * k1[i] );
+      odeDerivatives( stage, k2 );
+      for( int i = 0; i < n; i++ )
+         stage[i] = odeState[i] + h * ( a31 * k1[i] + a32 * k2[i] );
+      odeDerivatives( stage, k3 );
+      for( int i = 0; i < n; i++ )
+         stage[i] = odeState[i] + h * ( a41 * k1[i] + a42 * k2[i] + a43 * k3[i] );
+      odeDerivatives( stage, k4 );
+      for( int i = 0; i < n; i++ )
+         stage[i] = odeState[i] + h * ( a51 * k1[i] + a52 * k2[i] + a53 * k3[i] + a54 * k4[i] );
+      odeDerivatives( stage, k5 );
+      for( int i = 0; i < n; i++ )
+         stage[i] = odeState[i] + h * ( a61 * k1[i] + a62 * k2[i] + a63 * k3[i] + a64 * k4[i] + a65 * k5[i] );
+      odeDerivatives( stage, k6 );
+      for( int i = 0; i < n; i++ )
+         next[i] = odeState[i] + h * ( b1 * k1[i] + b3 * k3[i] + b4 * k4[i] + b5 * k5[i] + b6 * k6[i] );
+      odeDerivatives( next, k7 );
+
+      // Estimate the error from the difference between the
+      // solutions of order 5 and 4, scaled by the tolerance
+      double error = 0;
+      for( int i = 0; i < n; i++ )
+      {
+         double scale = absTol + relTol * std::max( fabs( odeState[i] ), fabs( next[i] ) );
+         double e = fabs( h * ( e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] + e7 * k7[i] ) ) / scale;
+         if( e > error )
+            error = e;
+      }
+
+      // Grow or shrink the step by at most a factor of 5
+      double factor = 5;
+      if( error > 0 )
+         factor = std::min( 5.0, std::max( 0.2, 0.9 * pow( error, -0.2 ) ) );
+
+      if( error <= 1 )
+      {
+         // Accept the step; the last stage is the first of the
+         // next step
+         odeState.swap( next );
+         k1.swap( k7 );
+         odeTime = last ? end : odeTime + h;
+         if( !last || h * factor < odeStep )
+            odeStep = h * factor;
+      }
+      else
+      {
+         odeStep = h * factor;
+      }
+   }
+}
+
+
+// Find the rate of change of the expected number of atoms
+// of each Element: each Reaction proceeds at its rate
+// constant times the product of the numbers of its
+// reactants.  Unlike in ssaPropensity, a Reaction of two
+// atoms of the same Element goes as n * n, the limit for
+// many atoms.
+void
+Sim::odeDerivatives( const std::vector<double>& state, std::vector<double>& derivs )
+{
+   for( unsigned int i = 0; i < derivs.size(); i++ )
+      derivs[i] = 0;
+
+   for( unsigned int j = 0; j < rateRxns.size(); j++ )
+   {
+      double rate = rateConstants[j];
+      for( unsigned int r = 0; r < rateReactants[j].size(); r++ )
+         rate *= state[ rateReactants[j][r] ];
+      for( unsigned int c = 0; c < rateChanges[j].size(); c++ )
+         derivs[ rateChanges[j][c].first ] += rateChanges[j][c].second * rate;
+   }
+}
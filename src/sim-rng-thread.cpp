@@ -0,0 +1,130 @@
+/* sim-rng-thread.cpp
+ */
+
+#include <cstdlib> // exit
+#include <iostream>
+#ifdef BLR_USELINUX
+#include <sched.h> // sched_getaffinity
+#endif
+#include <unistd.h> // sysconf
+#include "sim.h"
+
+
+// The RNG thread draws the random numbers of the next fill
+// of randNums into randNumsNext while the engine works
+// through those of the current fill, and generateRandNums
+// swaps the two arrays.  Every draw from the generator
+// happens in the same order as without the thread, so the
+// simulation is unchanged.  That holds only if nothing else
+// draws between two fills; it is worth it only if each fill
+// is long enough to outweigh handing it over, and there is
+// a second CPU to draw on.
+bool
+Sim::useRNGThread()
+{
+#ifdef HAVE_PTHREADS
+   if( !o->rngThread || randNums_length_in_64_bit_ints < RNG_THREAD_MIN_LENGTH )
+      return false;
+
+#ifdef BLR_USELINUX
+   cpu_set_t allowed;
+   CPU_ZERO( &allowed );
+   sched_getaffinity( 0, sizeof( allowed ), &allowed );
+   int nCPUs = CPU_COUNT( &allowed );
+#else
+   int nCPUs = sysconf( _SC_NPROCESSORS_ONLN );
+#endif
+   if( nCPUs < 2 )
+      return false;
+
+   if( !rngThreadStarted )
+   {
+      pthread_mutex_init( &rngLock, NULL );
+      pthread_cond_init( &rngCond, NULL );
+      if( pthread_create( &rngThread, NULL, &Sim::rngThreadMain, this ) != 0 )
+      {
+         std::cerr << "Error: Unable to start the RNG thread" << std::endl;
+         exit( EXIT_FAILURE );
+      }
+      rngThreadStarted = true;
+   }
+   return true;
+#else
+   return false;
+#endif
+}
+
+
+#ifdef HAVE_PTHREADS
+// The body of the RNG thread, which fills randNumsNext
+// each time a fill is requested
+void*
+Sim::rngThreadMain( void* sim )
+{
+   Sim* s = (Sim*)sim;
+   pthread_mutex_lock( &s->rngLock );
+   while( true )
+   {
+      while( s->rngFillState != RNG_FILL_REQUESTED )
+         pthread_cond_wait( &s->rngCond, &s->rngLock );
+      pthread_mutex_unlock( &s->rngLock );
+
+      s->fillRandNums( s->randNumsNext );
+
+      pthread_mutex_lock( &s->rngLock );
+      s->rngFillState = RNG_FILL_DONE;
+      pthread_cond_broadcast( &s->rngCond );
+   }
+   return NULL;
+}
+#endif
+
+
+// Have the RNG thread start drawing the next fill
+void
+Sim::startRandFill()
+{
+#ifdef HAVE_PTHREADS
+   pthread_mutex_lock( &rngLock );
+   rngFillState = RNG_FILL_REQUESTED;
+   pthread_cond_broadcast( &rngCond );
+   pthread_mutex_unlock( &rngLock );
+#endif
+}
+
+
+// Wait until randNumsNext holds the next fill, drawing it
+// here if the RNG thread was not asked to
+void
+Sim::finishRandFill()
+{
+#ifdef HAVE_PTHREADS
+   pthread_mutex_lock( &rngLock );
+   while( rngFillState == RNG_FILL_REQUESTED )
+      pthread_cond_wait( &rngCond, &rngLock );
+   bool drawn = ( rngFillState == RNG_FILL_DONE );
+   rngFillState = RNG_FILL_IDLE;
+   pthread_mutex_unlock( &rngLock );
+   if( !drawn )
+      fillRandNums( randNumsNext );
+#endif
+}
+
+
+// Wait for the RNG thread to finish any fill and put it
+// aside, before the generator is seeded again or the
+// arrays are given back
+void
+Sim::stopRandFill()
+{
+#ifdef HAVE_PTHREADS
+   if( !rngThreadStarted )
+      return;
+
+   pthread_mutex_lock( &rngLock );
+   while( rngFillState == RNG_FILL_REQUESTED )
+      pthread_cond_wait( &rngCond, &rngLock );
+   rngFillState = RNG_FILL_IDLE;
+   pthread_mutex_unlock( &rngLock );
+#endif
+}
@@ -0,0 +1,213 @@
+/* sim-simd.cpp
+ */
+
+#ifdef HAVE_AVX2
+
+#include <cstring> // memcpy
+#include <immintrin.h>
+#include "sim.h"
+
+#define AVX2 __attribute__((target("avx2")))
+
+
+// Returns the low 3 bits of each of the 32 64-bit
+// random numbers starting at r as 32 bytes in order
+static inline AVX2 __m256i
+lowBits32( const uint64_t* r )
+{
+   const __m256i mask = _mm256_set1_epi64x( 0x7 );
+   __m256i a = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r +  0 ) ), mask );
+   __m256i b = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r +  4 ) ), mask );
+   __m256i c = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r +  8 ) ), mask );
+   __m256i d = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r + 12 ) ), mask );
+   __m256i e = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r + 16 ) ), mask );
+   __m256i f = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r + 20 ) ), mask );
+   __m256i g = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r + 24 ) ), mask );
+   __m256i h = _mm256_and_si256( _mm256_loadu_si256( (const __m256i*)( r + 28 ) ), mask );
+
+   // Pack the 64-bit values down to bytes; each pack works
+   // within 128-bit lanes, so the result holds pairs of
+   // bytes in the order a0a1 b0b1 ... h0h1 | a2a3 b2b3 ... h2h3
+   __m256i abcd = _mm256_packus_epi16( _mm256_packus_epi32( a, b ), _mm256_packus_epi32( c, d ) );
+   __m256i efgh = _mm256_packus_epi16( _mm256_packus_epi32( e, f ), _mm256_packus_epi32( g, h ) );
+   __m256i pairs = _mm256_packus_epi16( abcd, efgh );
+
+   // Restore the original order
+   pairs = _mm256_permute4x64_epi64( pairs, _MM_SHUFFLE( 3, 1, 2, 0 ) );
+   const __m256i order = _mm256_setr_epi8(
+         0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15,
+         0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15 );
+   return _mm256_shuffle_epi8( pairs, order );
+}
+
+
+// Fill moveDirBits for the 32 positions starting at (x,y),
+// which must lie within one segment
+void AVX2
+Sim::findMoveIntentsAVX2( int x, int y )
+{
+   // Table translating a direction into its bit
+   const __m256i dirBit = _mm256_setr_epi8(
+         1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+         1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0 );
+   const __m256i zero = _mm256_setzero_si256();
+
+   int64_t i = rowOffset[ y ] + colOffset[ x ];
+   __m256i bits = _mm256_shuffle_epi8( dirBit, lowBits32( randNums + ( y & randRowMask ) * (int64_t)o->worldX + x ) );
+   __m256i empty = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)( lattice + i ) ), zero );
+   _mm256_storeu_si256( (__m256i*)( moveDirBits + i ), _mm256_andnot_si256( empty, bits ) );
+}
+
+
+// Count the claims staked on the 32 positions starting at
+// (x,y); the positions and their left and right neighbors
+// must lie within one segment
+void AVX2
+Sim::countMoveClaimsAVX2( int x, int y )
+{
+   const uint8_t* row[3];
+   row[0] = moveDirBits + rowOffset[ y == 0 ? o->worldY - 1 : y - 1 ] + colOffset[ x ];
+   row[1] = moveDirBits + rowOffset[ y ] + colOffset[ x ];
+   row[2] = moveDirBits + rowOffset[ y == o->worldY - 1 ? 0 : y + 1 ] + colOffset[ x ];
+
+   // One claim for an atom sitting in each position
+   __m256i count = _mm256_setzero_si256();
+   __m256i empty = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)row[1] ), count );
+   count = _mm256_add_epi8( count, _mm256_andnot_si256( empty, _mm256_set1_epi8( 1 ) ) );
+
+   // One claim for each neighbor one step in the opposite
+   // direction that wants to move in this direction
+   for( int dir = 0; dir < 8; dir++ )
+   {
+      const __m256i bit = _mm256_set1_epi8( (char)( 1 << dir ) );
+      __m256i source = _mm256_loadu_si256( (const __m256i*)( row[ 1 - dirdy[dir] ] - dirdx[dir] ) );
+      count = _mm256_sub_epi8( count, _mm256_cmpeq_epi8( _mm256_and_si256( source, bit ), bit ) );
+   }
+
+   _mm256_storeu_si256( (__m256i*)( claimed + rowOffset[ y ] + colOffset[ x ] ), count );
+}
+
+
+// Returns a bitmask of the atoms among the 32 positions
+// starting at (x,y) that can move, and stores in occupied
+// a bitmask of the positions that have atoms; has the same
+// requirements as countMoveClaimsAVX2
+uint32_t AVX2
+Sim::canMoveAVX2( int x, int y, uint32_t* occupied )
+{
+   const uint8_t* row[3];
+   row[0] = claimed + rowOffset[ y == 0 ? o->worldY - 1 : y - 1 ] + colOffset[ x ];
+   row[1] = claimed + rowOffset[ y ] + colOffset[ x ];
+   row[2] = claimed + rowOffset[ y == o->worldY - 1 ? 0 : y + 1 ] + colOffset[ x ];
+
+   const __m256i one = _mm256_set1_epi8( 1 );
+   __m256i bits = _mm256_loadu_si256( (const __m256i*)( moveDirBits + rowOffset[ y ] + colOffset[ x ] ) );
+
+   // Check the claims on each atom's destination
+   __m256i destClear = _mm256_setzero_si256();
+   for( int dir = 0; dir < 8; dir++ )
+   {
+      const __m256i bit = _mm256_set1_epi8( (char)( 1 << dir ) );
+      __m256i wants = _mm256_cmpeq_epi8( _mm256_and_si256( bits, bit ), bit );
+      __m256i dest = _mm256_loadu_si256( (const __m256i*)( row[ 1 + dirdy[dir] ] + dirdx[dir] ) );
+      destClear = _mm256_or_si256( destClear, _mm256_and_si256( wants, _mm256_cmpeq_epi8( dest, one ) ) );
+   }
+
+   // Check the claims on each atom's current position
+   __m256i sourceClear = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)row[1] ), one );
+
+   *occupied = ~(uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( bits, _mm256_setzero_si256() ) );
+   return (uint32_t)_mm256_movemask_epi8( _mm256_and_si256( destClear, sourceClear ) );
+}
+
+
+// Pack the 32 positions starting at (x,y), which must lie
+// within one segment, into bitmasks of the positions that
+// have atoms and of each bit of the direction of movement
+void AVX2
+Sim::packPlanesAVX2( int x, int y, uint32_t* occupied, uint32_t* dirBits )
+{
+   __m256i species = _mm256_loadu_si256( (const __m256i*)( lattice + rowOffset[ y ] + colOffset[ x ] ) );
+   *occupied = ~(uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( species, _mm256_setzero_si256() ) );
+
+   // Shift bit k of each direction into the top bit of its
+   // byte; 16-bit shifts are safe since directions are < 8
+   __m256i dir = lowBits32( randNums + ( y & randRowMask ) * (int64_t)o->worldX + x );
+   dirBits[0] = (uint32_t)_mm256_movemask_epi8( _mm256_slli_epi16( dir, 7 ) );
+   dirBits[1] = (uint32_t)_mm256_movemask_epi8( _mm256_slli_epi16( dir, 6 ) );
+   dirBits[2] = (uint32_t)_mm256_movemask_epi8( _mm256_slli_epi16( dir, 5 ) );
+}
+
+
+// Loads 4 bytes starting at p into 64-bit lanes
+static inline AVX2 __m256i
+load4( const uint8_t* p )
+{
+   int bytes;
+   memcpy( &bytes, p, sizeof( bytes ) );
+   return _mm256_cvtepu8_epi64( _mm_cvtsi32_si128( bytes ) );
+}
+
+
+// Returns a bitmask of the 8 positions starting at (x,y)
+// whose attempted reactions pass the probability test;
+// the positions and their left and right neighbors must
+// lie within one segment, and every pair of reactants is
+// assumed to have 2 channels
+uint32_t AVX2
+Sim::findRxnAttemptsAVX2( int x, int y )
+{
+   const int nIndices = rxnIndices;
+#ifdef HAVE_COMPILED_CHEMISTRY
+   const uint16_t* pairs = compiledRxnPairs;
+   const uint64_t* thresholds = compiledRxnThresholds;
+#else
+   const uint16_t* pairs = rxnPairs;
+   const uint64_t* thresholds = rxnThresholds;
+#endif
+   const uint8_t* here = lattice + rowOffset[ y ] + colOffset[ x ];
+   const uint8_t* below = lattice + rowOffset[ y == o->worldY - 1 ? 0 : y + 1 ] + colOffset[ x ];
+   const __m256i low16 = _mm256_set1_epi64x( 0xFFFF );
+   uint32_t passed = 0;
+
+   for( int i = 0; i < 8; i += 4 )
+   {
+      __m256i rand = _mm256_srli_epi64( _mm256_loadu_si256( (const __m256i*)( randNums + ( y & randRowMask ) * (int64_t)o->worldX + x + i ) ), 3 );
+
+      // Find rand % 5 without division: since 2^16 % 5 == 1,
+      // the sum of the 16-bit digits of rand has the same
+      // remainder, and folding the sum twice brings it below
+      // 2^16, where multiplying by 52429 / 2^18 divides by 5
+      __m256i sum = _mm256_add_epi64(
+            _mm256_add_epi64( _mm256_and_si256( rand, low16 ), _mm256_and_si256( _mm256_srli_epi64( rand, 16 ), low16 ) ),
+            _mm256_add_epi64( _mm256_and_si256( _mm256_srli_epi64( rand, 32 ), low16 ), _mm256_srli_epi64( rand, 48 ) ) );
+      sum = _mm256_add_epi64( _mm256_and_si256( sum, low16 ), _mm256_srli_epi64( sum, 16 ) );
+      sum = _mm256_add_epi64( _mm256_and_si256( sum, low16 ), _mm256_srli_epi64( sum, 16 ) );
+      __m256i quotient = _mm256_srli_epi64( _mm256_mul_epu32( sum, _mm256_set1_epi64x( 52429 ) ), 18 );
+      __m256i slot = _mm256_sub_epi64( sum, _mm256_add_epi64( _mm256_slli_epi64( quotient, 2 ), quotient ) );
+
+      // Select the Element index of the neighbor in each
+      // slot, or nIndices for first-order reactions
+      __m256i partner = _mm256_set1_epi64x( nIndices );
+      partner = _mm256_blendv_epi8( partner, load4( here + i + 1 ),  _mm256_cmpeq_epi64( slot, _mm256_set1_epi64x( 1 ) ) ); // E
+      partner = _mm256_blendv_epi8( partner, load4( below + i + 1 ), _mm256_cmpeq_epi64( slot, _mm256_set1_epi64x( 2 ) ) ); // SE
+      partner = _mm256_blendv_epi8( partner, load4( below + i ),     _mm256_cmpeq_epi64( slot, _mm256_set1_epi64x( 3 ) ) ); // S
+      partner = _mm256_blendv_epi8( partner, load4( below + i - 1 ), _mm256_cmpeq_epi64( slot, _mm256_set1_epi64x( 4 ) ) ); // SW
+
+      // Gather the pair numbers 32 bits at a time (rxnPairs
+      // is padded for this) and keep the low 16 bits
+      __m256i entry = _mm256_add_epi64( _mm256_mul_epu32( load4( here + i ), _mm256_set1_epi64x( nIndices + 1 ) ), partner );
+      __m128i pair = _mm_and_si128( _mm256_i64gather_epi32( (const int*)pairs, entry, 2 ), _mm_set1_epi32( 0xFFFF ) );
+
+      // Gather the thresholds from the compiled rxnTable and
+      // perform the probability test
+      entry = _mm256_add_epi64( _mm256_slli_epi64( _mm256_cvtepu32_epi64( pair ), 1 ), _mm256_and_si256( rand, _mm256_set1_epi64x( 1 ) ) );
+      __m256i threshold = _mm256_i64gather_epi64( (const long long*)thresholds, entry, 8 );
+      __m256i pass = _mm256_cmpgt_epi64( threshold, rand );
+      passed |= (uint32_t)_mm256_movemask_pd( _mm256_castsi256_pd( pass ) ) << i;
+   }
+
+   return passed;
+}
+
+#endif /* HAVE_AVX2 */
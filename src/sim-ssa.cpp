@@ -0,0 +1,364 @@
+/* sim-ssa.cpp
+ */
+
+#include <algorithm> // stable_sort
+#include <cmath>     // HUGE_VAL, ldexp, log
+#include "sim.h"
+
+
+// Order Reactions by the indices of their reactants, which
+// unlike the keys of the rxnTable do not depend on the
+// order of the load file
+static bool
+reactantsBefore( Reaction* a, Reaction* b )
+{
+   ElementVector ra = a->getReactants();
+   ElementVector rb = b->getReactants();
+   if( ra.size() != rb.size() )
+      return ra.size() < rb.size();
+   for( unsigned int j = 0; j < ra.size(); j++ )
+      if( ra[j]->getIndex() != rb[j]->getIndex() )
+         return ra[j]->getIndex() < rb[j]->getIndex();
+   return false;
+}
+
+
+// Find the rate at which each Reaction would occur in a
+// well-mixed world of the same size, following table 1 of
+// "Zeroth-, First-, and Second-Order Chemical Reactions
+// and Michaelis-Menten Enzyme Kinetics in an Artificial
+// Chemistry" (Gill, 2010).  A position attempts each
+// Reaction of its pair of reactants with probability
+// prob / ( 5 * c ) per iteration, where c is the number of
+// channels of the pair, and a world of N positions, each
+// with 8 neighbors, holds about
+//
+//   N positions of Solvent and Solvent (4 per position)
+//   8 n_A           pairs of A and Solvent
+//   8 n_A n_B / N   pairs of A and B
+//   4 n_A n_A / N   pairs of A and A
+//
+// counting only the 4 neighbors that a position attempts
+// to react with.  As in gillespie.R, Solvent is taken to be
+// plentiful.  The rates are shared by the well-mixed
+// simulation and the expected census.
+void
+Sim::compileRateLaws()
+{
+   // Find the rate constant, the reactants and the net change
+   // in the atoms of each Reaction, leaving out Solvent
+   double nPositions = (double)o->worldX * (double)o->worldY;
+   rateRxns.clear();
+   rateConstants.clear();
+   rateReactants.clear();
+   rateChanges.clear();
+   if( o->doRxns )
+   {
+      // The Reactions are taken in a fixed order, so that a
+      // run loaded from its config.out samples them the same
+      // way; Reactions of the same reactants keep the order
+      // of the load file, which config.out preserves
+      std::vector<Reaction*> rxns;
+      for( ReactionMap::iterator i = rxnTable.begin(); i != rxnTable.end(); i++ )
+         rxns.push_back( i->second );
+      std::stable_sort( rxns.begin(), rxns.end(), reactantsBefore );
+
+      for( unsigned int i = 0; i < rxns.size(); i++ )
+      {
+         Reaction* rxn = rxns[i];
+         ElementVector reactants = rxn->getReactants();
+         ElementVector products = rxn->getProducts();
+
+         std::vector<int> atoms;
+         std::vector<int> change( rxnIndices, 0 );
+         for( unsigned int j = 0; j < reactants.size(); j++ )
+         {
+            if( reactants[j]->getIndex() != 0 )
+            {
+               atoms.push_back( reactants[j]->getIndex() );
+               change[ reactants[j]->getIndex() ]--;
+            }
+         }
+         for( unsigned int j = 0; j < products.size(); j++ )
+            if( products[j]->getIndex() != 0 )
+               change[ products[j]->getIndex() ]++;
+
+         double rate = rxn->getProb() / ( 5.0 * rxnChannelsOf( rxn ) );
+         if( reactants.size() == 1 )
+         {
+            if( atoms.size() == 0 )
+               rate *= nPositions;
+         }
+         else
+         {
+            if( atoms.size() == 0 )
+               rate *= 4 * nPositions;
+            else if( atoms.size() == 1 )
+               rate *= 8;
+            else if( atoms[0] != atoms[1] )
+               rate *= 8 / nPositions;
+            else
+               rate *= 4 / nPositions;
+         }
+
+         std::vector<std::pair<int,int> > changes;
+         for( int index = 1; index < rxnIndices; index++ )
+            if( change[ index ] != 0 )
+               changes.push_back( std::pair<int,int>( index, change[ index ] ) );
+
+         rateRxns.push_back( rxn );
+         rateConstants.push_back( rate );
+         rateReactants.push_back( atoms );
+         rateChanges.push_back( changes );
+      }
+   }
+}
+
+
+// Set up a well-mixed simulation in place of a world: each
+// Element starts with as many atoms as buildWorld would
+// place, and the Reactions occur at the rates found by
+// compileRateLaws, or, for the well-mixed sampling of a
+// shuffled world, as often as they would in the world
+void
+Sim::buildWellMixed()
+{
+   // Nothing of the world is allocated
+   world = NULL;
+   worldSpare = NULL;
+   claimed = NULL;
+   lattice = NULL;
+   moveDirBits = NULL;
+   rowOffset = NULL;
+   colOffset = NULL;
+   positions = NULL;
+   occupancyPlane = NULL;
+   dirPlanes = NULL;
+   singlyClaimedPlane = NULL;
+   for( int i = 0; i < 4; i++ )
+      planeRows[i] = NULL;
+   kmcAtomIndex = NULL;
+   kmcClass = NULL;
+   kmcIndex = NULL;
+
+   // Initialize the random number generator
+   initRNG( o->seed );
+   generateRandNums();
+   randCursor = 0;
+
+   for( ElementMap::iterator i = periodicTable.begin(); i != periodicTable.end(); i++ )
+   {
+      Element* thisEle = i->second;
+      thisEle->count = (int64_t)((double)thisEle->getStartConc() * (double)maxPositions[ positionSets[ thisEle->getName() ] ] + 0.5);
+   }
+
+   // The well-mixed sampling of a shuffled world finds how
+   // likely an attempt on each pair of Elements is to pass
+   // from the same tables as executeRxns
+   if( o->doWellMixed )
+   {
+      int nEntries = rxnIndices * ( rxnIndices + 1 );
+      mixedPass.assign( nEntries, 0 );
+      for( int entry = 0; entry < nEntries; entry++ )
+      {
+         int pair = rxnPairs[ entry ];
+         for( int channel = 0; channel < rxnPairChannels[ pair ]; channel++ )
+            mixedPass[ entry ] += ldexp( (double)rxnThresholds[ rxnPairEntries[ pair ] + channel ], -61 ) / rxnPairChannels[ pair ];
+      }
+   }
+
+   // A Reaction depends on another if the other changes the
+   // number of any of its reactants
+   int nRxns = rateRxns.size();
+   ssaDependents.assign( nRxns, std::vector<int>() );
+   for( int j = 0; j < nRxns; j++ )
+   {
+      for( int k = 0; k < nRxns; k++ )
+      {
+         bool depends = ( j == k );
+         for( unsigned int c = 0; c < rateChanges[j].size(); c++ )
+            for( unsigned int r = 0; r < rateReactants[k].size(); r++ )
+               if( rateChanges[j][c].first == rateReactants[k][r] )
+                  depends = true;
+         if( depends )
+            ssaDependents[j].push_back( k );
+      }
+   }
+
+   // Draw the first firing time of every Reaction for the
+   // next reaction method, kept in an indexed binary heap
+   ssaTime = 0;
+   ssaPropensities.assign( nRxns, 0 );
+   ssaTimes.assign( nRxns, HUGE_VAL );
+   ssaHeap.resize( nRxns );
+   ssaHeapIndex.resize( nRxns );
+   for( int j = 0; j < nRxns; j++ )
+   {
+      ssaPropensities[j] = ssaPropensity( j );
+      ssaHeap[j] = j;
+      ssaHeapIndex[j] = j;
+   }
+   if( o->ssa == Options::SSA_NEXT_RXN )
+   {
+      for( int j = 0; j < nRxns; j++ )
+      {
+         if( ssaPropensities[j] > 0 )
+            ssaTimes[j] = -log( nextUniform() ) / ssaPropensities[j];
+         ssaHeapUpdate( j );
+      }
+   }
+}
+
+
+// Advance the well-mixed simulation by one unit of time
+// (one iteration)
+void
+Sim::ssaAdvance()
+{
+   double end = itersCompleted + 1;
+   int nRxns = rateRxns.size();
+
+   if( o->ssa == Options::SSA_DIRECT )
+   {
+      while( true )
+      {
+         double total = 0;
+         for( int j = 0; j < nRxns; j++ )
+            total += ssaPropensities[j];
+         if( total <= 0 )
+            break;
+
+         // Since waiting times are memoryless, the event that
+         // would come after the end of the iteration can be
+         // discarded
+         ssaTime -= log( nextUniform() ) / total;
+         if( ssaTime >= end )
+            break;
+
+         // Pick a Reaction with probability proportional to
+         // its propensity; rounding errors can run past the
+         // last, in which case the last possible is taken
+         double target = nextUniform() * total;
+         int chosen = -1;
+         for( int j = 0; j < nRxns; j++ )
+         {
+            if( ssaPropensities[j] > 0 )
+            {
+               chosen = j;
+               target -= ssaPropensities[j];
+               if( target < 0 )
+                  break;
+            }
+         }
+
+         ssaFire( chosen );
+         for( unsigned int d = 0; d < ssaDependents[ chosen ].size(); d++ )
+         {
+            int k = ssaDependents[ chosen ][d];
+            ssaPropensities[k] = ssaPropensity( k );
+         }
+      }
+   }
+   else
+   {
+      while( nRxns > 0 && ssaTimes[ ssaHeap[0] ] < end )
+      {
+         int chosen = ssaHeap[0];
+         ssaTime = ssaTimes[ chosen ];
+         ssaFire( chosen );
+
+         // The firing time of the Reaction that fired is drawn
+         // anew; those of the Reactions whose propensities
+         // changed are rescaled, which leaves them as
+         // distributed as if drawn anew
+         for( unsigned int d = 0; d < ssaDependents[ chosen ].size(); d++ )
+         {
+            int k = ssaDependents[ chosen ][d];
+            double oldPropensity = ssaPropensities[k];
+            ssaPropensities[k] = ssaPropensity( k );
+            if( ssaPropensities[k] <= 0 )
+               ssaTimes[k] = HUGE_VAL;
+            else if( k != chosen && oldPropensity > 0 )
+               ssaTimes[k] = ssaTime + ( oldPropensity / ssaPropensities[k] ) * ( ssaTimes[k] - ssaTime );
+            else
+               ssaTimes[k] = ssaTime - log( nextUniform() ) / ssaPropensities[k];
+            ssaHeapUpdate( k );
+         }
+      }
+   }
+
+   ssaTime = end;
+}
+
+
+// Returns the propensity of Reaction j: its rate constant
+// times the number of distinct sets of its reactants
+double
+Sim::ssaPropensity( int j )
+{
+   const std::vector<int>& atoms = rateReactants[j];
+   double propensity = rateConstants[j];
+   if( atoms.size() >= 1 )
+   {
+      double n = elementsByIndex[ atoms[0] ]->count;
+      if( atoms.size() == 1 )
+         propensity *= n;
+      else if( atoms[0] != atoms[1] )
+         propensity *= n * elementsByIndex[ atoms[1] ]->count;
+      else
+         propensity *= n * ( n - 1 );
+   }
+   return propensity;
+}
+
+
+// Fire Reaction j once
+void
+Sim::ssaFire( int j )
+{
+   for( unsigned int c = 0; c < rateChanges[j].size(); c++ )
+      elementsByIndex[ rateChanges[j][c].first ]->count += rateChanges[j][c].second;
+}
+
+
+// Restore the order of the heap of firing times after the
+// time of Reaction j has changed
+void
+Sim::ssaHeapUpdate( int j )
+{
+   int i = ssaHeapIndex[j];
+
+   // Sift up
+   while( i > 0 && ssaTimes[ ssaHeap[i] ] < ssaTimes[ ssaHeap[ ( i - 1 ) / 2 ] ] )
+   {
+      ssaHeapSwap( i, ( i - 1 ) / 2 );
+      i = ( i - 1 ) / 2;
+   }
+
+   // Sift down
+   int n = ssaHeap.size();
+   while( true )
+   {
+      int smallest = i;
+      if( 2 * i + 1 < n && ssaTimes[ ssaHeap[ 2 * i + 1 ] ] < ssaTimes[ ssaHeap[ smallest ] ] )
+         smallest = 2 * i + 1;
+      if( 2 * i + 2 < n && ssaTimes[ ssaHeap[ 2 * i + 2 ] ] < ssaTimes[ ssaHeap[ smallest ] ] )
+         smallest = 2 * i + 2;
+      if( smallest == i )
+         break;
+      ssaHeapSwap( i, smallest );
+      i = smallest;
+   }
+}
+
+
+// Swap entries a and b of the heap of firing times
+void
+Sim::ssaHeapSwap( int a, int b )
+{
+   int temp = ssaHeap[a];
+   ssaHeap[a] = ssaHeap[b];
+   ssaHeap[b] = temp;
+   ssaHeapIndex[ ssaHeap[a] ] = a;
+   ssaHeapIndex[ ssaHeap[b] ] = b;
+}
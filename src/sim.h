@@ -9,13 +9,24 @@
 #endif
 #include <list>
 #include <map>
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
 #include <ostream>
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 #include <stdint.h>
 #include <vector>
+#include "arena.h"
 #include "atom.h"
 #include "element.h"
+#include "lattice-file.h"
 #include "options.h"
 #include "reaction.h"
+#ifdef HAVE_COMPILED_CHEMISTRY
+#include "compiled-chemistry.h"
+#endif
 
 typedef std::map<std::string,Element*> ElementMap;
 typedef std::multimap<int,Reaction*> ReactionMap;
@@ -41,21 +52,28 @@ class Sim
       void forceProgressReport();
       void finishProgressReport();
       void writeCensus();
+      void writeExpectedCensus();
       void printWorld();
 
       Atom** world;
       ElementMap periodicTable;
       ReactionMap rxnTable;
-      int getWorldIndex( int x, int y );
+      int64_t getWorldIndex( int x, int y );
+      Atom* getAtom( int x, int y );
+      Element* getSpecies( int x, int y );
+      void copyLattice( uint8_t* dest );
+      void findTracked( std::vector<int64_t>& positions );
 
       // File management
       std::vector<std::ostream*> out;
+      std::ostream* expectedOut;
 #ifdef HAVE_QT
       std::vector<QTemporaryFile*> tempFiles;
 #endif
 
-      static const unsigned int MAX_RXNS_PER_SET_OF_REACTANTS = 2;
-      static const unsigned int MAX_ELES_NOT_INCLUDING_SOLVENT = 8;
+      static const int MIN_RXN_CHANNELS = 2;
+      static const int MIN_POSITION_SETS = 8;
+      static const unsigned int MAX_ELES_NOT_INCLUDING_SOLVENT = 255;
 
    private:
       // Sim attributes
@@ -68,10 +86,45 @@ class Sim
 
       std::list<ElementVector> extinctionTypes;
 
+      // The large buffers of the world are carved from arena,
+      // which is reset by destroyWorld; shuffleWorld builds
+      // the shuffled world in worldSpare and swaps it in
+      Arena arena;
+      Atom** worldSpare;
       uint8_t* claimed;
+      uint8_t* lattice;
+      uint8_t* moveDirBits;
+      ElementVector elementsByIndex;
+
+      // Lattice layout
+      static const int TILE_W = 256;
+      static const int TILE_H = 16;
+      int tileW;
+      int tileH;
+      int64_t latticeSize;
+      int64_t* rowOffset;
+      int* colOffset;
+      void setLayout();
+      int64_t getLatticeIndex( int x, int y );
+
+      // A kernel applied to the segment [x0, x1) of row y,
+      // which is contiguous in the lattice
+      typedef void (Sim::*SegmentKernel)( int y, int x0, int x1 );
+      void forEachSegment( SegmentKernel kernel );
+      void forEachSegmentInRow( SegmentKernel kernel, int y );
+
+      // With --lattice-file the lattice lives in a file mapped
+      // into memory, after the header that describes it
+      LatticeFileHeader* latticeFile;
+      int64_t latticeFileSize;
+      uint8_t* mapLatticeFile();
+      void beginLatticeFileUpdate();
+      void endLatticeFileUpdate();
+      void syncLatticeFile();
+      void unmapLatticeFile();
       unsigned int* positions;
-      int maxPositions[ MAX_ELES_NOT_INCLUDING_SOLVENT ];
-      bool positionSetReserved[ MAX_ELES_NOT_INCLUDING_SOLVENT ];
+      std::vector<int64_t> maxPositions;
+      std::vector<bool> positionSetReserved;
       StringCounter positionSets;
 
       // I/O attributes
@@ -79,24 +132,286 @@ class Sim
       int scrY;
       int lastProgressUpdate;
       
-      // RNG parameters
-      int randNums_length_in_64_bit_ints;
+      // RNG parameters; the random number of position (x,y)
+      // is randNums[ ( y & randRowMask ) * worldX + x ], so
+      // that a lean world can hold the random numbers of only
+      // randRowMask + 1 rows at a time.  fill_array64 takes
+      // the length as an int, so the array is filled in pieces
+      // of at most RAND_FILL_PIECE.
+      static const int64_t RAND_FILL_PIECE = (int64_t)1 << 30;
+      int64_t randNums_length_in_64_bit_ints;
       uint64_t* randNums;
+      int randRowMask;
+      int64_t randCursor;
+
+      // With the RNG thread, the numbers of the next fill of
+      // randNums are drawn into randNumsNext while the engine
+      // uses those in randNums; see sim-rng-thread.cpp
+      static const int64_t RNG_THREAD_MIN_LENGTH = (int64_t)1 << 16;
+      enum { RNG_FILL_IDLE, RNG_FILL_REQUESTED, RNG_FILL_DONE };
+      bool rngPipelined;
+      uint64_t* randNumsNext;
+      int rngFillState;
+#ifdef HAVE_PTHREADS
+      bool rngThreadStarted;
+      pthread_t rngThread;
+      pthread_mutex_t rngLock;
+      pthread_cond_t rngCond;
+      static void* rngThreadMain( void* sim );
+#endif
+      bool useRNGThread();
+      void fillRandNums( uint64_t* array );
+      void startRandFill();
+      void finishRandFill();
+      void stopRandFill();
 
       // Private engine methods
       void initializeEngine();
+      void step();
       void initRNG( int initSeed );
       void generateRandNums();
+      uint64_t* allocateRandNums( int64_t length );
+      uint64_t nextRand();
+      double nextUniform();
       void shufflePositions();
       void reservePositionSet( Element* ele );
       void reservePositionSet( Element* ele, int set );
       void shuffleWorld();
+      void placeAtoms();
 
-      void moveAtoms();
+      template<bool STATS> void moveAtoms();
+      void findMoveIntentsSegment( int y, int x0, int x1 );
+      void countMoveClaimsSegment( int y, int x0, int x1 );
+      uint8_t countMoveClaims( int x, int y );
+      template<bool STATS> void moveAtomsSegment( int y, int x0, int x1 );
+      bool canMove( int x, int y );
+      template<bool STATS> void moveAtom( int x, int y, int dir, bool canMove );
       int* dirdx;
       int* dirdy;
 
-      void executeRxns();
+      // Bitplane engine; each plane holds one bit per
+      // position, with planeWords 64-bit words per row
+      int planeWords;
+      uint64_t lastWordMask;
+      uint64_t* occupancyPlane;
+      uint64_t* dirPlanes;
+      uint64_t* singlyClaimedPlane;
+      uint64_t* planeRows[4];
+      template<bool STATS> void moveAtomsBitplanes();
+      void packPlanesRow( int y );
+      void findSinglyClaimedRow( int y );
+      template<bool STATS> void moveAtomsBitplanesRow( int y );
+      void findMovableRow( int y, uint64_t* movable );
+      void findMoveIntentsPlaneRow( int y, int dir, uint64_t* wants );
+      void shiftPlaneRow( const uint64_t* src, uint64_t* dst, int dx );
+
+      void compileRxnTable();
+      uint64_t probThreshold( double prob );
+      int* rxndx;
+      int* rxndy;
+      uint16_t* rxnPairs;
+      uint64_t* rxnThresholds;
+      Reaction** rxnChoices;
+      int* rxnPairChannels;
+      int* rxnPairEntries;
+      int rxnChannelsOf( Reaction* rxn );
+
+      // The number of Element indices in the reaction tables
+      // and the most channels of any pair, which are fixed by
+      // the chemistry if one was compiled in
+#ifdef HAVE_COMPILED_CHEMISTRY
+      static const int rxnIndices = COMPILED_ELEMENTS;
+      static const int rxnChannels = COMPILED_CHANNELS;
+#else
+      int rxnIndices;
+      int rxnChannels;
+#endif
+
+      // When no reaction attempt can pass with a probability
+      // above 2^-rxnSkipShift, the attempts are found by
+      // geometric skip sampling; rxnSkipShift is 0 otherwise
+      static const int MIN_RXN_SKIP_SHIFT = 2;
+      int rxnSkipShift;
+      double rxnSkipLogScale;
+
+      // A reaction that has passed the probability test
+      struct RxnAttempt
+      {
+         int x;
+         int y;
+         int64_t site;
+         int64_t partner;
+         int slot;
+         Reaction* rxn;
+      };
+      std::vector<RxnAttempt> rxnAttempts;
+      uint8_t rxnClaimsEpoch;
+
+      template<bool TRACKING, bool SECOND_ORDER> void executeRxns();
+      template<bool SECOND_ORDER> void findRxnAttemptsSegment( int y, int x0, int x1 );
+      template<bool SECOND_ORDER> void findRxnAttempt( int x, int y );
+      template<bool SECOND_ORDER> void findRxnAttempt( int x, int y, uint64_t rand, int shift );
+      template<bool SECOND_ORDER> void findRxnAttemptsSkipRow( int y );
+      void claimRxnAttempts( unsigned int begin, unsigned int end );
+      void claimRxnPosition( int64_t i );
+      void nextRxnClaimsEpoch();
+      template<bool TRACKING, bool SECOND_ORDER> void resolveRxnAttempts( unsigned int begin, unsigned int end );
+      template<bool TRACKING> void executeRxn( RxnAttempt& attempt );
+
+      template<bool STATS, bool TRACKING, bool SECOND_ORDER> void sweepWorld();
+      template<bool STATS, bool TRACKING, bool SECOND_ORDER> void sweepRow( int s, int y );
+      std::vector<unsigned int> rxnAttemptsEnd;
+
+      // Lean world, which keeps only the lattice and the
+      // bitplanes: there are no Atoms, the Element counts are
+      // kept by the engine itself, and the reaction claims are
+      // staked in the bitplanes, which the moves are done with
+      // by then
+      void leanMoveAtoms();
+      void leanMoveAtomsRow( int y );
+      template<bool SECOND_ORDER> void leanExecuteRxns();
+      void leanClaimPosition( int x, int y );
+      bool leanClaimedOnce( int x, int y );
+      template<bool SECOND_ORDER> void leanResolveRxnAttempts( unsigned int begin, unsigned int end );
+      void leanExecuteRxn( RxnAttempt& attempt );
+      void leanSetPosition( int64_t i, Element* ele );
+
+      // Kinetic Monte Carlo engine; the reaction instances
+      // are the 5 slots of each position, numbered
+      // world index * 5 + slot, and are grouped by the pair
+      // of reactants they would bring together
+      bool kmcBuilt;
+      std::vector<int> kmcAtoms;
+      int* kmcAtomIndex;
+      uint16_t* kmcClass;
+      int* kmcIndex;
+      std::vector<std::vector<int> > kmcMembers;
+      std::vector<double> kmcRates;
+      std::vector<double> kmcPairProbs;
+      std::vector<double> kmcTree;
+      double kmcRxnRate;
+      template<bool STATS, bool TRACKING, bool SECOND_ORDER> void kmcAdvance();
+      template<bool TRACKING, bool SECOND_ORDER> void kmcExecuteRxn();
+      template<bool SECOND_ORDER> void kmcBuild();
+      void kmcSumRates();
+      void kmcClassify( int x, int y, int slot );
+      template<bool SECOND_ORDER> void kmcUpdate( int x, int y );
+      void kmcSyncAtom( int w );
+      void kmcTreeAdd( int pair, double delta );
+      int kmcTreeFind( double target );
+
+      // Mass-action rate laws of the Reactions in a well-mixed
+      // world of the same size; rateConstants holds the rate
+      // constant of each Reaction, rateReactants its reactants
+      // and rateChanges the net change in each Element
+      std::vector<Reaction*> rateRxns;
+      std::vector<double> rateConstants;
+      std::vector<std::vector<int> > rateReactants;
+      std::vector<std::vector<std::pair<int,int> > > rateChanges;
+      void compileRateLaws();
+
+      // Well-mixed stochastic simulation, by Gillespie's
+      // direct method or Gibson and Bruck's next reaction
+      // method; ssaDependents holds the Reactions whose
+      // propensities change when each Reaction fires
+      std::vector<std::vector<int> > ssaDependents;
+      std::vector<double> ssaPropensities;
+      double ssaTime;
+      std::vector<double> ssaTimes;
+      std::vector<int> ssaHeap;
+      std::vector<int> ssaHeapIndex;
+      void buildWellMixed();
+      void ssaAdvance();
+      double ssaPropensity( int j );
+      void ssaFire( int j );
+      void ssaHeapUpdate( int j );
+      void ssaHeapSwap( int a, int b );
+
+      // Well-mixed sampling of the reactions of a shuffled
+      // world from the numbers of atoms of each Element;
+      // mixedPass holds, for each pair of Elements laid out as
+      // rxnPairs, the probability that an attempt on the pair
+      // passes the probability test
+      std::vector<double> mixedPass;
+      void mixedAdvance();
+      int64_t sampleBinomial( int64_t n, double p );
+
+      // Deterministic integration of the rate laws for the
+      // expected census, by the Dormand-Prince method; odeState
+      // holds the expected number of atoms of each Element at
+      // time odeTime, and odeStep the size of the next step
+      std::vector<double> odeState;
+      double odeTime;
+      double odeStep;
+      void odeInit();
+      void odeAdvance( double end );
+      void odeDerivatives( const std::vector<double>& state, std::vector<double>& derivs );
+
+      // Decomposition of the world into slabs of rows, one
+      // for each MPI rank.  A rank holds the slabRows rows of
+      // the world starting at row slabY, followed by copies of
+      // the first 2 rows of the rank below and the last 2 rows
+      // of the rank above, so that its own world wraps around
+      // onto the rows of its neighbors; worldRows is the
+      // height of the whole world.  Without MPI, the one slab
+      // is the whole world.
+      int mpiRank;
+      int mpiRanks;
+      int slabY;
+      int slabRows;
+      int worldRows;
+      int64_t censusCount( Element* ele );
+
+      // Startup tuning of the engine options with --autotune;
+      // each choice is timed over AUTOTUNE_ITERS iterations
+      // after one to warm up
+      static const int AUTOTUNE_ITERS = 3;
+      void autotune();
+      void applyTuning();
+      std::string getTuneKey();
+      bool readTuneFile( const std::string& key );
+      void writeTuneFile( const std::string& key );
+
+      // Placement of the process and its memory on the CPUs
+      // and NUMA nodes of its host, with --pin and --numa
+      int placedCPU;
+      int placedNode;
+      std::vector<std::string> placement;
+      void placeProcess();
+      void findPlacement();
+      void printPlacement( std::ostream* out );
+#ifdef HAVE_MPI
+      static const int MPI_HALO_ROWS = 2;
+      std::vector<int64_t> mpiCounts;
+      void mpiInit();
+      void mpiAgreeOnEnd();
+      void mpiReduceCounts();
+      int64_t mpiShareOfAtoms( double conc, int set );
+      template<bool STATS> void mpiMoveAtoms();
+      template<bool TRACKING, bool SECOND_ORDER> void mpiExecuteRxns();
+      void mpiExchangeRows( uint8_t* plane, int nRows );
+      void mpiSendAtoms( int fromRow, int dest, int source, int toRow );
+      void mpiImportRow();
+      void mpiExchangeClaims();
+      void mpiExportRow();
+      void mpiWriteDiffusion( const std::string& text );
+#endif
+
+      // Engine variants
+      void selectEngine();
+      template<bool STATS, bool TRACKING, bool SECOND_ORDER> void selectEngine();
+      void (Sim::*moveEngine)();
+      void (Sim::*rxnEngine)();
+
+      // SIMD kernels
+      bool useAVX2;
+#ifdef HAVE_AVX2
+      void findMoveIntentsAVX2( int x, int y );
+      void countMoveClaimsAVX2( int x, int y );
+      uint32_t canMoveAVX2( int x, int y, uint32_t* occupied );
+      uint32_t findRxnAttemptsAVX2( int x, int y );
+      void packPlanesAVX2( int x, int y, uint32_t* occupied, uint32_t* dirBits );
+#endif
 
       ElementVector ev( int elementCount, ... );
 
@@ -110,6 +425,7 @@ class Sim
       void printEles( std::ostream* out );
       void printRxns( std::ostream* out );
       void printExtincts( std::ostream* out );
+      void printMemory( std::ostream* out );
 };
 
 #endif /* SIM_H */
@@ -3,17 +3,58 @@
 
 #ifdef HAVE_QT
 
+#include <algorithm> // max, min
+#include <cmath>     // ceil
+#include <cstring>   // memcpy
 #include <iostream>
+#include <vector>
 #include "viewer.h"
 
+// Constants of OpenGL 1.2 and 1.3, which the headers of
+// some systems do not define
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_TEXTURE0
+#define GL_TEXTURE0 0x84C0
+#endif
+#ifndef GL_TEXTURE1
+#define GL_TEXTURE1 0x84C1
+#endif
+
+
+// The shaders that color the lattice texture: the vertex
+// shader applies the texture matrix, which selects the part
+// of the world in view, and the fragment shader looks up
+// the color of the Element index of each texel in the
+// palette texture
+static const char* vertexShaderSource =
+   "varying vec2 position;\n"
+   "void main()\n"
+   "{\n"
+   "   position = ( gl_TextureMatrix[0] * gl_MultiTexCoord0 ).xy;\n"
+   "   gl_Position = ftransform();\n"
+   "}\n";
+static const char* fragmentShaderSource =
+   "uniform sampler2D lattice;\n"
+   "uniform sampler2D palette;\n"
+   "varying vec2 position;\n"
+   "void main()\n"
+   "{\n"
+   "   float index = texture2D( lattice, position ).r * 255.0;\n"
+   "   gl_FragColor = texture2D( palette, vec2( ( index + 0.5 ) / 256.0, 0.5 ) );\n"
+   "}\n";
+
 
 // Constructor
-Viewer::Viewer( Options* initOptions, Sim* initSim, QWidget *parent ) 
+Viewer::Viewer( Options* initOptions, Sim* initSim, Worker* initWorker, Snapshot* initShown, QWidget *parent ) 
 	: QGLWidget( parent )
 {
    // Copy constructor arguments
    o = initOptions;
    sim = initSim;
+   worker = initWorker;
+   shown = initShown;
 
    // Degrees to rotate the coordinate space
    // counterclockwise around the associated axis
@@ -21,97 +62,174 @@ Viewer::Viewer( Options* initOptions, Sim* initSim, QWidget *parent )
    rotationY = 0.0;
    rotationZ = 0.0;
 
-   if( false )
-   {
-      zoomXRange  = 64;    // lattice sqaures wide
-      zoomYRange  = 64;    // lattice squares high
-      zoomXWindow = 210;   // pixels wide
-      zoomYWindow = 210;   // pixels high
-   }
+   // Show the whole world
+   zoom = 1;
+   minX = 0;
+   minY = 0;
+
+   // The OpenGL resources are created by initializeGL
+   program = NULL;
+   latticeBuffer = NULL;
+   latticeTexture = 0;
+   paletteTexture = 0;
+   textureX = 0;
+   textureY = 0;
+   uploadedSequence = -1;
+   usePalette = false;
 
    adjustPaintRegion();
 }
 
 
-// Set up view range
+// Destructor
+Viewer::~Viewer()
+{
+   makeCurrent();
+   delete latticeBuffer;
+   if( latticeTexture != 0 )
+      glDeleteTextures( 1, &latticeTexture );
+   if( paletteTexture != 0 )
+      glDeleteTextures( 1, &paletteTexture );
+}
+
+
+// Set up view range; the widget has one pixel per
+// lattice square of the whole world, and zooming in shows
+// a smaller region of the world magnified
 void
 Viewer::adjustPaintRegion()
 {
-   if( true )
-   {
-      zoomXRange  = o->worldX;
-      zoomYRange  = o->worldY;
-      zoomXWindow = o->worldX;
-      zoomYWindow = o->worldY;
-   }
+   zoomXRange  = std::max( 1, o->worldX / zoom );
+   zoomYRange  = std::max( 1, o->worldY / zoom );
+   zoomXWindow = o->worldX;
+   zoomYWindow = o->worldY;
 
-   minX = 0;
-   maxX = o->worldX;
-   minY = 0;
-   maxY = o->worldY;
+   minX = std::min( std::max( minX, 0 ), o->worldX - zoomXRange );
+   maxX = minX + zoomXRange;
+   minY = std::min( std::max( minY, 0 ), o->worldY - zoomYRange );
+   maxY = minY + zoomYRange;
 
    // Force the widget to have exactly one
    // pixel per lattice square
-   setFixedSize( maxX-minX, maxY-minY );
+   setFixedSize( zoomXWindow, zoomYWindow );
+}
+
+
+// Returns the index of the Element at (x,y) in the
+// Snapshot shown, or 0 for Solvent
+int
+Viewer::getSpeciesIndex( int x, int y )
+{
+   if( shown->lattice.empty() )
+      return 0;
+
+   int wrappedX = ( x + shown->worldX ) % shown->worldX;
+   int wrappedY = ( y + shown->worldY ) % shown->worldY;
+   return shown->lattice[ wrappedX + (int64_t)wrappedY * shown->worldX ];
+}
+
+
+// Returns true if the atom at (x,y) in the Snapshot
+// shown is tracked
+bool
+Viewer::isTracked( int x, int y )
+{
+   if( shown->lattice.empty() )
+      return false;
+
+   int wrappedX = ( x + shown->worldX ) % shown->worldX;
+   int wrappedY = ( y + shown->worldY ) % shown->worldY;
+   int64_t position = wrappedX + (int64_t)wrappedY * shown->worldX;
+   for( unsigned int i = 0; i < shown->tracked.size(); i++ )
+      if( shown->tracked[i] == position )
+         return true;
+   return false;
 }
 
 
 // Mark an Atom as tracked when the mouse is
-// pressed on or near its position
+// pressed on or near its position; the worker thread
+// tracks the Atom nearest the position in the world as
+// it is between iterations, since the atoms seen in the
+// Snapshot shown may have moved since, and the Snapshot
+// only tells whether there is an Atom near enough
 void
 Viewer::mousePressEvent( QMouseEvent *event )
 {
-   int mouseX, mouseY, x, y;
+   int mouseX, mouseY;
    mouseX = event->x() * ( zoomXRange ) / ( zoomXWindow ) + minX;
    mouseY = ( zoomYWindow - 1 - event->y() ) * ( zoomYRange ) / ( zoomYWindow ) + minY;
 
-   x = mouseX;
-   y = mouseY;
+   bool done = ( getSpeciesIndex( mouseX, mouseY ) != 0 && !isTracked( mouseX, mouseY ) );
+   int offset = 1;
+   double offsetMax = 5.0 * (double)zoomXWindow / (double)zoomXRange;
 
-   if( sim->world[ sim->getWorldIndex( x, y ) ] == NULL || sim->world[ sim->getWorldIndex( x, y ) ]->isTracked() )
+   while( !done && offset < offsetMax )
    {
-      bool done = false;
-      int offset = 1;
-      double offsetMax = 5.0 * (double)zoomXWindow / (double)zoomXRange;
-
-      while( !done && offset < offsetMax )
+      for( int x = mouseX - offset; x <= mouseX + offset && !done; x++ )
       {
-         for( x = mouseX - offset; x <= mouseX + offset && !done; x++ )
+         for( int y = mouseY - offset; y <= mouseY + offset && !done; y++ )
          {
-            for( y = mouseY - offset; y <= mouseY + offset && !done; y++ )
-            {
-               if( sim->world[ sim->getWorldIndex( x, y ) ] != NULL && !sim->world[ sim->getWorldIndex( x, y ) ]->isTracked() )
-               {
-                  done = true;
-               }
-            }
+            if( getSpeciesIndex( x, y ) != 0 && !isTracked( x, y ) )
+               done = true;
          }
-         offset++;
       }
+      offset++;
    }
 
-   x--;
-   y--;
-
-   if( sim->world[ sim->getWorldIndex( x, y ) ] != NULL )
+   if( done )
    {
-      sim->world[ sim->getWorldIndex( x, y ) ]->setTracked( true );
+      worker->requestTrack( mouseX, mouseY, (int)ceil( offsetMax ) );
       event->accept();
+      emit atomTracked();
    } else {
       event->ignore();
    }
+}
+
 
+// Zoom in or out by a factor of two, keeping the lattice
+// square under the mouse in place
+void
+Viewer::wheelEvent( QWheelEvent *event )
+{
+   int mouseX, mouseY;
+   mouseX = event->x() * ( zoomXRange ) / ( zoomXWindow ) + minX;
+   mouseY = ( zoomYWindow - 1 - event->y() ) * ( zoomYRange ) / ( zoomYWindow ) + minY;
+
+   if( event->delta() > 0 && zoom < MAX_ZOOM )
+   {
+      zoom *= 2;
+   }
+   else if( event->delta() < 0 && zoom > 1 )
+   {
+      zoom /= 2;
+   }
+   else
+   {
+      event->ignore();
+      return;
+   }
+
+   adjustPaintRegion();
+   minX = mouseX - event->x() * ( zoomXRange ) / ( zoomXWindow );
+   minY = mouseY - ( zoomYWindow - 1 - event->y() ) * ( zoomYRange ) / ( zoomYWindow );
+   adjustPaintRegion();
+
+   event->accept();
    updateGL();
 }
 
 
-
 // Sets up the OpenGL rendering context, defines
 // display lists, etc.; gets called once before
 // the first time resizeGL() or paintGL() is called
 void
 Viewer::initializeGL()
 {
+   // Resolve the OpenGL functions newer than 1.1
+   initializeGLFunctions( context() );
+
    // Set background color
    qglClearColor( Qt::black );
 
@@ -119,16 +237,59 @@ Viewer::initializeGL()
    // indistinguishable for points
    glShadeModel( GL_FLAT );
 
-   // Use the z-buffer, i.e., check to see
-   // whether or not a pixel will be hidden
-   // behind other pixels and therefore should
-   // not be drawn
-   glEnable( GL_DEPTH_TEST );
-
    // Use facet culling, i.e., remove facets
    // of polygons that are not facing the
    // window
    glEnable( GL_CULL_FACE );
+
+   // Create the lattice texture, which wraps around
+   // like the world and shows each texel as a
+   // square when magnified
+   glGenTextures( 1, &latticeTexture );
+   glBindTexture( GL_TEXTURE_2D, latticeTexture );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
+   glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+
+   // Color the lattice with the shaders if they can be
+   // used, looking up the colors in the palette texture
+   program = new QGLShaderProgram( context(), this );
+   usePalette = QGLShaderProgram::hasOpenGLShaderPrograms( context() ) &&
+      program->addShaderFromSourceCode( QGLShader::Vertex, vertexShaderSource ) &&
+      program->addShaderFromSourceCode( QGLShader::Fragment, fragmentShaderSource ) &&
+      program->link();
+   if( usePalette )
+   {
+      program->bind();
+      program->setUniformValue( "lattice", 0 );
+      program->setUniformValue( "palette", 1 );
+      program->release();
+
+      glGenTextures( 1, &paletteTexture );
+      glBindTexture( GL_TEXTURE_2D, paletteTexture );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+      glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+      glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, PALETTE_SIZE, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+   }
+   else
+   {
+      delete program;
+      program = NULL;
+   }
+
+   // Upload the lattice through a pixel buffer if they
+   // are supported, so that the texture is filled from it
+   // without waiting for the copy
+   latticeBuffer = new QGLBuffer( QGLBuffer::PixelUnpackBuffer );
+   latticeBuffer->setUsagePattern( QGLBuffer::StreamDraw );
+   if( !latticeBuffer->create() )
+   {
+      delete latticeBuffer;
+      latticeBuffer = NULL;
+   }
 }
 
 
@@ -152,8 +313,8 @@ Viewer::resizeGL( int width, int height )
    glLoadIdentity();
 
    // Multiply the current matrix by a perspective
-   // matrix (2D lattice points are drawn in the
-   // plane z = -8.0)
+   // matrix (the lattice is drawn in the plane
+   // z = -8.0, where the window spans 0 to 1)
    glFrustum( 0, 0.5, 0.0, 0.5, 4.0, 16.0 );
 
    // Switch back to manipulating the model view
@@ -162,6 +323,110 @@ Viewer::resizeGL( int width, int height )
 }
 
 
+// Find the color of each Element by its index; Solvent
+// is left the color of the background
+void
+Viewer::findColors( std::vector<QColor>& colors )
+{
+   colors.assign( PALETTE_SIZE, QColor( Qt::black ) );
+   for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
+   {
+      Element* ele = i->second;
+      if( ele->getIndex() > 0 && ele->getIndex() < PALETTE_SIZE )
+         colors[ ele->getIndex() ] = QColor( ele->getColor().c_str() );
+   }
+}
+
+
+// Fill the palette texture with the colors of the
+// Elements
+void
+Viewer::uploadPalette( std::vector<QColor>& colors )
+{
+   uint8_t palette[ PALETTE_SIZE * 4 ];
+   for( int i = 0; i < PALETTE_SIZE; i++ )
+   {
+      palette[ 4 * i + 0 ] = colors[i].red();
+      palette[ 4 * i + 1 ] = colors[i].green();
+      palette[ 4 * i + 2 ] = colors[i].blue();
+      palette[ 4 * i + 3 ] = 255;
+   }
+
+   glBindTexture( GL_TEXTURE_2D, paletteTexture );
+   glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, PALETTE_SIZE, 1, GL_RGBA, GL_UNSIGNED_BYTE, palette );
+}
+
+
+// Fill the lattice texture from the Snapshot shown,
+// unless it holds that Snapshot already; without the
+// palette, the colors are looked up here, and the texture
+// is filled every time in case they have changed
+void
+Viewer::uploadLattice( std::vector<QColor>& colors )
+{
+   glBindTexture( GL_TEXTURE_2D, latticeTexture );
+
+   // Resize the texture with the world
+   if( shown->worldX != textureX || shown->worldY != textureY )
+   {
+      textureX = shown->worldX;
+      textureY = shown->worldY;
+      if( usePalette )
+         glTexImage2D( GL_TEXTURE_2D, 0, GL_LUMINANCE8, textureX, textureY, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL );
+      else
+         glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, textureX, textureY, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+      uploadedSequence = -1;
+   }
+   if( usePalette && shown->sequence == uploadedSequence )
+      return;
+
+   const uint8_t* pixels = &shown->lattice[0];
+   int64_t size = shown->lattice.size();
+   GLenum format = GL_LUMINANCE;
+   if( !usePalette )
+   {
+      colorBuffer.resize( 4 * shown->lattice.size() );
+      for( unsigned int i = 0; i < shown->lattice.size(); i++ )
+      {
+         QColor& color = colors[ shown->lattice[i] ];
+         colorBuffer[ 4 * i + 0 ] = color.red();
+         colorBuffer[ 4 * i + 1 ] = color.green();
+         colorBuffer[ 4 * i + 2 ] = color.blue();
+         colorBuffer[ 4 * i + 3 ] = 255;
+      }
+      pixels = &colorBuffer[0];
+      size = colorBuffer.size();
+      format = GL_RGBA;
+   }
+
+   // Rows of the lattice are not padded
+   glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+   bool uploaded = false;
+   if( latticeBuffer != NULL )
+   {
+      // Allocating the buffer again each time gives up its
+      // old contents, so that filling it does not wait for
+      // the last upload to finish
+      latticeBuffer->bind();
+      latticeBuffer->allocate( (int)size );
+      void* mapped = latticeBuffer->map( QGLBuffer::WriteOnly );
+      if( mapped != NULL )
+      {
+         memcpy( mapped, pixels, size );
+         latticeBuffer->unmap();
+         glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, textureX, textureY, format, GL_UNSIGNED_BYTE, 0 );
+         uploaded = true;
+      }
+      latticeBuffer->release();
+   }
+   if( !uploaded )
+      glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, textureX, textureY, format, GL_UNSIGNED_BYTE, pixels );
+
+   uploadedSequence = shown->sequence;
+}
+
+
 // Renders the OpenGL scene; gets called whenever
 // the widget needs to be updated
 void
@@ -172,6 +437,8 @@ Viewer::paintGL()
 
    // Set up view range
    adjustPaintRegion();
+   if( shown->lattice.empty() )
+      return;
 
    // Switch to manipulating the model view matrix
    // stack for scene manipulations
@@ -190,67 +457,69 @@ Viewer::paintGL()
    glRotatef( rotationY, 0.0, 1.0, 0.0 );
    glRotatef( rotationZ, 0.0, 0.0, 1.0 );
 
-   // Percentage of the widget window belonging to
-   // each lattice square
-   double xWindowPerLatticeSquare = 1.0 / (double)o->worldX;
-   double yWindowPerLatticeSquare = 1.0 / (double)o->worldY;
-
-   double atomDiameterX        = 1.0 * xWindowPerLatticeSquare;      // in percentage of the window
-   double atomDiameterY        = 1.0 * yWindowPerLatticeSquare;      // in percentage of the window
-   double atomRadiusX          = atomDiameterX / 2.0;                // in percentage of the window
-   double atomRadiusY          = atomDiameterY / 2.0;                // in percentage of the window
-
-   double trackedAtomDiameterX = 5.0 * xWindowPerLatticeSquare;      // in percentage of the window
-   double trackedAtomDiameterY = 5.0 * yWindowPerLatticeSquare;      // in percentage of the window
-   double trackedAtomRadiusX   = trackedAtomDiameterX / 2.0;         // in percentage of the window
-   double trackedAtomRadiusY   = trackedAtomDiameterY / 2.0;         // in percentage of the window
+   // Bring the textures up to date
+   std::vector<QColor> colors;
+   findColors( colors );
+   if( usePalette )
+   {
+      glActiveTexture( GL_TEXTURE1 );
+      uploadPalette( colors );
+      glActiveTexture( GL_TEXTURE0 );
+   }
+   uploadLattice( colors );
 
-   // Start specifying points as vertices
-   glBegin( GL_POINTS );
+   // Zoom by transforming the texture coordinates of the
+   // window, 0 to 1, to the region of the world in view
+   glMatrixMode( GL_TEXTURE );
+   glLoadIdentity();
+   glTranslatef( (GLfloat)minX / textureX, (GLfloat)minY / textureY, 0.0 );
+   glScalef( (GLfloat)zoomXRange / textureX, (GLfloat)zoomYRange / textureY, 1.0 );
+   glMatrixMode( GL_MODELVIEW );
 
-   for( int y = minY; y < maxY; y++ )
+   // Draw the lattice as a single quad covering the window
+   if( usePalette )
    {
-      for( int x = minX; x < maxX; x++ )
-      {
-         if( x >= 0 && x < o->worldX && y >= 0 && y < o->worldY )
-         {
-            if( sim->world[ sim->getWorldIndex( x, y ) ] != NULL )
-            {
-               // Set the pen color to the Atom's Element's color
-               qglColor( QColor( sim->world[ sim->getWorldIndex( x, y ) ]->getType()->getColor().c_str() ) );
-
-               // Create a vertex for the Atom
-               if( sim->world[ sim->getWorldIndex( x, y ) ]->isTracked() )
-               {
-                  // Tracked ions
-                  for( double xOff = -trackedAtomRadiusX; xOff < trackedAtomRadiusX; xOff += 1.0 / (double)zoomXWindow )
-                  {
-                     for( double yOff = -trackedAtomRadiusY; yOff < trackedAtomRadiusY; yOff += 1.0 / (double)zoomYWindow )
-                     {
-                        glVertex3f( (GLfloat)( ( x + 1 - minX ) / (double)zoomXRange + xOff ),
-                                    (GLfloat)( ( y + 1 - minY ) / (double)zoomYRange + yOff ),
-                                    (GLfloat)0.0 );
-                     }
-                  }
-               } else {
-                  // Nontracked ions
-                  for( double xOff = -atomRadiusX; xOff < atomRadiusX; xOff += 1.0 / (double)zoomXWindow )
-                  {
-                     for( double yOff = -atomRadiusY; yOff < atomRadiusY; yOff += 1.0 / (double)zoomYWindow )
-                     {
-                        glVertex3f( (GLfloat)( ( x + 1 - minX ) / (double)zoomXRange + xOff ),
-                                    (GLfloat)( ( y + 1 - minY ) / (double)zoomYRange + yOff ),
-                                    (GLfloat)0.0 );
-                     }
-                  }
-               }
-            }
-         }
-      }
+      program->bind();
+   }
+   else
+   {
+      qglColor( Qt::white );
+      glEnable( GL_TEXTURE_2D );
+   }
+   glBegin( GL_QUADS );
+   glTexCoord2f( 0.0, 0.0 ); glVertex3f( 0.0, 0.0, 0.0 );
+   glTexCoord2f( 1.0, 0.0 ); glVertex3f( 1.0, 0.0, 0.0 );
+   glTexCoord2f( 1.0, 1.0 ); glVertex3f( 1.0, 1.0, 0.0 );
+   glTexCoord2f( 0.0, 1.0 ); glVertex3f( 0.0, 1.0, 0.0 );
+   glEnd();
+   if( usePalette )
+      program->release();
+   else
+      glDisable( GL_TEXTURE_2D );
+
+   // Draw the tracked atoms in view over the lattice as
+   // squares at least five pixels wide
+   double trackedAtomRadiusX = std::max( 2.5 / (double)zoomXWindow, 1.0 / (double)zoomXRange );   // in percentage of the window
+   double trackedAtomRadiusY = std::max( 2.5 / (double)zoomYWindow, 1.0 / (double)zoomYRange );   // in percentage of the window
+   glBegin( GL_QUADS );
+   for( unsigned int i = 0; i < shown->tracked.size(); i++ )
+   {
+      int x = shown->tracked[i] % shown->worldX;
+      int y = shown->tracked[i] / shown->worldX;
+      if( x < minX || x >= maxX || y < minY || y >= maxY )
+         continue;
+
+      // Set the pen color to the Atom's Element's color
+      qglColor( colors[ shown->lattice[ shown->tracked[i] ] ] );
+
+      GLfloat centerX = (GLfloat)( ( x + 0.5 - minX ) / (double)zoomXRange );
+      GLfloat centerY = (GLfloat)( ( y + 0.5 - minY ) / (double)zoomYRange );
+      glVertex3f( centerX - trackedAtomRadiusX, centerY - trackedAtomRadiusY, 0.0 );
+      glVertex3f( centerX + trackedAtomRadiusX, centerY - trackedAtomRadiusY, 0.0 );
+      glVertex3f( centerX + trackedAtomRadiusX, centerY + trackedAtomRadiusY, 0.0 );
+      glVertex3f( centerX - trackedAtomRadiusX, centerY + trackedAtomRadiusY, 0.0 );
    }
-   // Finish specifying points as vertices
    glEnd();
 }
 
 #endif /* HAVE_QT */
-
@@ -5,24 +5,41 @@
 #define VIEWER_H 
 #ifdef HAVE_QT
 
+#include <QGLBuffer>
+#include <QGLFunctions>
+#include <QGLShaderProgram>
 #include <QGLWidget>
 #include <QMouseEvent>
+#include <QWheelEvent>
+#include <stdint.h>
+#include <vector>
 #include "options.h"
 #include "sim.h"
+#include "worker.h"
 
-class Viewer : public QGLWidget
+// The OpenGL functions newer than 1.1, which the headers of
+// some systems do not declare, are called through
+// QGLFunctions
+class Viewer : public QGLWidget, protected QGLFunctions
 {
    Q_OBJECT
 
    public:
       // Constructor
-      Viewer( Options* initOptions, Sim* initSim, QWidget *parent = 0 );
+      Viewer( Options* initOptions, Sim* initSim, Worker* initWorker, Snapshot* initShown, QWidget *parent = 0 );
+
+      // Destructor
+      ~Viewer();
 
    public slots:
       void adjustPaintRegion();
 
+   signals:
+      void atomTracked();
+
    protected:
       void mousePressEvent( QMouseEvent *event );
+      void wheelEvent( QWheelEvent *event );
       void initializeGL();
       void resizeGL( int width, int height );
       void paintGL();
@@ -30,6 +47,8 @@ class Viewer : public QGLWidget
    private:
       Options* o;
       Sim* sim;
+      Worker* worker;
+      Snapshot* shown;
       int minX;
       int minY;
       int maxX;
@@ -38,12 +57,36 @@ class Viewer : public QGLWidget
       int zoomYRange;
       int zoomXWindow;
       int zoomYWindow;
+      int zoom;
 
       GLfloat rotationX;
       GLfloat rotationY;
       GLfloat rotationZ;
+
+      // The lattice of the Snapshot shown is drawn as one
+      // texture of Element indices, uploaded through
+      // latticeBuffer when a new Snapshot is shown and
+      // colored by looking the indices up in the palette
+      // texture; without shaders, the colors are looked up
+      // here and the texture holds them instead
+      static const int MAX_ZOOM = 64;
+      static const int PALETTE_SIZE = 256;
+      QGLShaderProgram* program;
+      QGLBuffer* latticeBuffer;
+      GLuint latticeTexture;
+      GLuint paletteTexture;
+      int textureX;
+      int textureY;
+      int uploadedSequence;
+      bool usePalette;
+      std::vector<uint8_t> colorBuffer;
+
+      void findColors( std::vector<QColor>& colors );
+      void uploadPalette( std::vector<QColor>& colors );
+      void uploadLattice( std::vector<QColor>& colors );
+      int getSpeciesIndex( int x, int y );
+      bool isTracked( int x, int y );
 };
 
 #endif /* HAVE_QT */
 #endif /* VIEWER_H */
-
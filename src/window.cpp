@@ -22,6 +22,15 @@ Window::Window( Options* initOptions, Sim* initSim, QWidget* parent, Qt::WindowF
    simPaused = false;
    quitRequested = false;
 
+   // Create the thread that runs the simulation and the
+   // timer that draws it
+   worker = new Worker( o, sim, this );
+   connect( worker, SIGNAL( finished() ), this, SLOT( simFinished() ) );
+
+   renderTimer = new QTimer( this );
+   renderTimer->setInterval( 1000 / RENDER_FPS );
+   connect( renderTimer, SIGNAL( timeout() ), this, SLOT( render() ) );
+
    // Create the gui components
    QHBoxLayout* mainLayout = new QHBoxLayout();
    mainLayout->addWidget( createCtrl() );
@@ -36,6 +45,9 @@ Window::Window( Options* initOptions, Sim* initSim, QWidget* parent, Qt::WindowF
 
    // Set the initial keyboard focus to the start button
    startBtn->setFocus();
+
+   // Draw the world as built
+   refresh();
 }
 
 
@@ -274,7 +286,8 @@ Window::createViewer()
    viewerFrame->setLayout( viewerLayout );
 
    // Viewer widget
-   viewer = new Viewer( o, sim, this );
+   viewer = new Viewer( o, sim, worker, &shown, this );
+   connect( viewer, SIGNAL( atomTracked() ), this, SLOT( refresh() ) );
    viewerLayout->addWidget( viewer );
 
    return viewerFrame;
@@ -292,7 +305,7 @@ Window::createPlot()
    plotFrame->setLayout( plotLayout );
 
    // Plot widget
-   plot = new Plot( o, sim, this );
+   plot = new Plot( o, sim, &shown, this );
    plot->setMinimumWidth( 350 );
    plotLayout->addWidget( plot );
 
@@ -315,30 +328,68 @@ Window::createStatusBar()
 }
 
 
-// The primary loop for running the simulation
+// Start running the simulation on the worker thread,
+// drawing it at a fixed rate until it stops
 void
 Window::runSim()
 {
-   while( sim->iterate() )
-   {
-      // Update gui components
+   worker->start();
+   renderTimer->start();
+}
+
+
+// Draw the last Snapshot published by the worker thread,
+// if it is new
+void
+Window::render()
+{
+   if( !worker->takeSnapshot( &shown ) )
+      return;
+
+   // Update gui components
+   if( simStarted )
       plot->update();
-      viewer->updateGL();
-      statusLbl->setText( "Iteration: " + QString::number( sim->getItersCompleted() ) + " of " + QString::number( o->maxIters )
-            + " | " + QString::number( (int)( 100 * (double)sim->getItersCompleted() / (double)o->maxIters ) ) + "\% complete" );
+   viewer->updateGL();
+   if( simStarted )
+      statusLbl->setText( "Iteration: " + QString::number( shown.iteration ) + " of " + QString::number( shown.maxIters )
+            + " | " + QString::number( (int)( 100 * (double)shown.iteration / (double)shown.maxIters ) ) + "\% complete" );
+}
 
-      // Check for Qt signals and events
-      QCoreApplication::processEvents();
 
-      // Check for pausing
-      if( simPaused )
-         return;
+// Publish and draw the world as it is now; while the
+// simulation is running, the next Snapshot published by the
+// worker thread is drawn instead
+void
+Window::refresh()
+{
+   if( !worker->isRunning() )
+   {
+      worker->record();
+      worker->publish();
    }
+   render();
+}
 
-   if( o->progress )
-      sim->forceProgressReport();
 
-   startPauseResume();
+// Called when the worker thread stops, either because the
+// simulation has ended or because it was paused
+void
+Window::simFinished()
+{
+   // The signal is sent before the thread has quite
+   // finished, so wait for it before publishing the last
+   // iteration from here
+   worker->wait();
+   renderTimer->stop();
+   refresh();
+
+   if( !simPaused )
+   {
+      if( o->progress )
+         sim->forceProgressReport();
+
+      startPauseResume();
+   }
 }
 
 
@@ -348,6 +399,14 @@ void
 Window::closeEvent( QCloseEvent* event )
 {
    quitRequested = true;
+
+   // Stop the simulation while the user decides, without
+   // treating it as paused or ended
+   bool wasRunning = worker->isRunning();
+   worker->blockSignals( true );
+   worker->stop();
+   worker->blockSignals( false );
+   renderTimer->stop();
    if( o->progress )
       sim->forceProgressReport();
 
@@ -371,9 +430,15 @@ Window::closeEvent( QCloseEvent* event )
       // Allow the application to close if the user has not
       // decided to cancel
       if( quitRequested )
+      {
          event->accept();
+      }
       else
+      {
          event->ignore();
+         if( wasRunning )
+            runSim();
+      }
    }
 }
 
@@ -385,7 +450,8 @@ Window::startPauseResume()
    switch( stackedBtnLayout->currentIndex() )
    {
       case 0: // startBtn
-         plot->update();
+         simStarted = true;
+         refresh();
          // no break
       case 2: // resumeBtn
          simStarted = true;
@@ -425,6 +491,7 @@ Window::startPauseResume()
       case 1: // pauseBtn
          simStarted = true;
          simPaused = true;
+         worker->stop();
 
          itersLbl->setEnabled( true );
          itersSlider->setEnabled( true );
@@ -462,7 +529,7 @@ Window::updateWidth( int newVal )
    sim->destroyWorld();
    o->worldX = newVal;
    sim->buildWorld();
-   viewer->updateGL();
+   refresh();
 }
 
 
@@ -474,7 +541,7 @@ Window::updateHeight( int newVal )
    sim->destroyWorld();
    o->worldY = newVal;
    sim->buildWorld();
-   viewer->updateGL();
+   refresh();
 }
 
 
@@ -485,7 +552,7 @@ Window::updateSeed( QString newVal )
    o->seed = newVal.toInt();
    sim->destroyWorld();
    sim->buildWorld();
-   viewer->updateGL();
+   refresh();
 }
 
 
@@ -525,7 +592,7 @@ Window::updateEleColor( int eleIndex )
       eles[ eleIndex ]->setColor( newColor.name().toStdString() );
       colorChips[ eleIndex ]->setStyleSheet( "background: " + QString( eles[ eleIndex ]->getColor().c_str() ) );
       viewer->updateGL();
-      if( sim->getItersCompleted() > 0 )
+      if( simStarted )
          plot->update();
    }
 }
@@ -616,7 +683,7 @@ Window::updateEleConc( int eleIndex )
    eles[ eleIndex ]->setStartConc( newConc );
    sim->destroyWorld();
    sim->buildWorld();
-   viewer->updateGL();
+   refresh();
 }
 
 
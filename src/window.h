@@ -10,6 +10,7 @@
 #include "plot.h"
 #include "sim.h"
 #include "viewer.h"
+#include "worker.h"
 
 class Window : public QMainWindow
 {
@@ -24,6 +25,9 @@ class Window : public QMainWindow
 
    public slots:
       void runSim();
+      void render();
+      void refresh();
+      void simFinished();
       void startPauseResume();
       void updateIters( int newVal );
       void updateWidth( int newVal );
@@ -47,6 +51,14 @@ class Window : public QMainWindow
       bool simPaused;
       bool quitRequested;
 
+      // The simulation runs on worker, and the gui draws the
+      // Snapshot shown, taken from it RENDER_FPS times a
+      // second by renderTimer
+      static const int RENDER_FPS = 30;
+      Worker* worker;
+      Snapshot shown;
+      QTimer* renderTimer;
+
       // GUI components
       Viewer* viewer;
       Plot* plot;
@@ -0,0 +1,242 @@
+/* worker.cpp
+ */
+
+#ifdef HAVE_QT
+
+#include <algorithm> // max, min
+#include "worker.h"
+
+
+// Constructor
+Snapshot::Snapshot()
+{
+   sequence = 0;
+   iteration = 0;
+   maxIters = 0;
+   worldX = 0;
+   worldY = 0;
+   nCounts = 0;
+   historyStart = 0;
+}
+
+
+// Returns the number of iterations whose counts are held
+int
+Snapshot::getHistoryLength()
+{
+   return ( nCounts > 0 ) ? history.size() / nCounts : 0;
+}
+
+
+// Returns the count of an Element after the iteration in
+// the given row of the history
+int64_t
+Snapshot::getCount( int row, int eleIndex )
+{
+   return history[ row * nCounts + eleIndex ];
+}
+
+
+// Constructor
+Worker::Worker( Options* initOptions, Sim* initSim, QObject* parent )
+   : QThread( parent )
+{
+   // Copy constructor arguments
+   o = initOptions;
+   sim = initSim;
+
+   stopRequested = 0;
+   front = -1;
+   reading = -1;
+   taken = 0;
+   published = 0;
+   historyStart = 0;
+   publishedRows = 0;
+}
+
+
+// The body of the thread, which runs the simulation until
+// it ends or is stopped, recording every iteration and
+// publishing a Snapshot whenever the gui has taken the last
+// one
+void
+Worker::run()
+{
+   while( stopRequested.fetchAndAddOrdered( 0 ) == 0 && sim->iterate() )
+   {
+      record();
+      if( taken.fetchAndAddOrdered( 0 ) == published )
+         publish();
+   }
+}
+
+
+// Ask the thread to stop after the iteration in progress
+// and wait until it has
+void
+Worker::stop()
+{
+   stopRequested.fetchAndStoreOrdered( 1 );
+   wait();
+   stopRequested.fetchAndStoreOrdered( 0 );
+}
+
+
+// Record the counts of the Elements after the last
+// iteration, replacing those recorded for the same
+// iteration before; called only from the thread running
+// the simulation, or from the gui while it is stopped
+void
+Worker::record()
+{
+   applyTrackRequests();
+
+   int nCounts = 0;
+   for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
+      nCounts = std::max( nCounts, i->second->getIndex() + 1 );
+
+   // The history starts over if the Elements have changed
+   // or the world has gone back to an earlier iteration
+   int iteration = sim->getItersCompleted();
+   int rows = ( nCounts > 0 ) ? history.size() / nCounts : 0;
+   if( history.size() != (unsigned int)( rows * nCounts ) || iteration < historyStart || iteration > historyStart + rows )
+   {
+      history.clear();
+      historyStart = iteration;
+      publishedRows = 0;
+      rows = 0;
+   }
+   if( iteration < historyStart + rows )
+   {
+      history.resize( ( iteration - historyStart ) * nCounts );
+      publishedRows = std::min( publishedRows, iteration - historyStart );
+   }
+
+   history.resize( history.size() + nCounts, 0 );
+   int64_t* row = &history[ history.size() - nCounts ];
+   for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
+      row[ i->second->getIndex() ] = i->second->count;
+}
+
+
+// Publish a Snapshot of the world and of the counts
+// recorded, unless the gui is still copying the buffer it
+// would be written to, in which case the next call
+// publishes instead.  Counts already in a Snapshot the gui
+// has taken are dropped.  The buffers are handed over
+// without locking: the gui marks the buffer it copies as
+// reading, and publishing stores front before loading
+// reading, while takeSnapshot stores reading before loading
+// front again, so that a buffer is never written while the
+// gui copies it.
+void
+Worker::publish()
+{
+   int current = front.fetchAndAddOrdered( 0 );
+   int back = ( current < 0 ) ? 0 : 1 - current;
+   if( reading.fetchAndAddOrdered( 0 ) == back )
+      return;
+
+   int nCounts = 0;
+   for( ElementMap::iterator i = sim->periodicTable.begin(); i != sim->periodicTable.end(); i++ )
+      nCounts = std::max( nCounts, i->second->getIndex() + 1 );
+   if( taken.fetchAndAddOrdered( 0 ) == published && nCounts > 0 )
+   {
+      history.erase( history.begin(), history.begin() + publishedRows * nCounts );
+      historyStart += publishedRows;
+   }
+
+   Snapshot* s = &buffers[ back ];
+   s->sequence = ++published;
+   s->iteration = sim->getItersCompleted();
+   s->maxIters = o->maxIters;
+   s->worldX = o->worldX;
+   s->worldY = o->worldY;
+   s->lattice.resize( (int64_t)o->worldX * o->worldY );
+   sim->copyLattice( &s->lattice[0] );
+   sim->findTracked( s->tracked );
+   s->nCounts = nCounts;
+   s->historyStart = historyStart;
+   s->history = history;
+   publishedRows = s->getHistoryLength();
+
+   front.fetchAndStoreOrdered( back );
+}
+
+
+// Copy the last Snapshot published into dest unless it is
+// the one dest holds already; returns true if it was copied
+bool
+Worker::takeSnapshot( Snapshot* dest )
+{
+   int current;
+   do
+   {
+      current = front.fetchAndAddOrdered( 0 );
+      if( current < 0 )
+         return false;
+      reading.fetchAndStoreOrdered( current );
+   } while( front.fetchAndAddOrdered( 0 ) != current );
+
+   bool copied = false;
+   if( buffers[ current ].sequence != dest->sequence )
+   {
+      *dest = buffers[ current ];
+      taken.fetchAndStoreOrdered( dest->sequence );
+      copied = true;
+   }
+   reading.fetchAndStoreOrdered( -1 );
+   return copied;
+}
+
+
+// Track the untracked atom nearest (x,y), if there is one
+// less than maxOffset away, once the iteration in progress
+// is done
+void
+Worker::requestTrack( int x, int y, int maxOffset )
+{
+   TrackRequest request;
+   request.x = x;
+   request.y = y;
+   request.maxOffset = maxOffset;
+
+   QMutexLocker locker( &trackLock );
+   trackRequests.push_back( request );
+}
+
+
+// Track the atoms asked for by requestTrack, searching
+// outward from each position clicked as the viewer does
+void
+Worker::applyTrackRequests()
+{
+   QMutexLocker locker( &trackLock );
+   for( unsigned int i = 0; i < trackRequests.size() && sim->world != NULL; i++ )
+   {
+      int mouseX = trackRequests[i].x;
+      int mouseY = trackRequests[i].y;
+      Atom* found = sim->getAtom( mouseX, mouseY );
+      if( found != NULL && found->isTracked() )
+         found = NULL;
+
+      for( int offset = 1; found == NULL && offset < trackRequests[i].maxOffset; offset++ )
+      {
+         for( int x = mouseX - offset; x <= mouseX + offset && found == NULL; x++ )
+         {
+            for( int y = mouseY - offset; y <= mouseY + offset && found == NULL; y++ )
+            {
+               Atom* thisAtom = sim->getAtom( x, y );
+               if( thisAtom != NULL && !thisAtom->isTracked() )
+                  found = thisAtom;
+            }
+         }
+      }
+
+      if( found != NULL )
+         found->setTracked( true );
+   }
+   trackRequests.clear();
+}
+
+#endif /* HAVE_QT */
@@ -0,0 +1,101 @@
+/* worker.h
+ */
+
+#ifndef WORKER_H
+#define WORKER_H
+#ifdef HAVE_QT
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThread>
+#include <stdint.h>
+#include <vector>
+#include "options.h"
+#include "sim.h"
+
+// The state of the simulation as the gui draws it: the
+// iteration and the last one to be run, the Element index
+// at every position, the tracked atoms, and the count of
+// each Element after every iteration from historyStart
+// onward that the gui may not have plotted yet
+class Snapshot
+{
+   public:
+      // Constructor
+      Snapshot();
+
+      int sequence;
+      int iteration;
+      int maxIters;
+      int worldX;
+      int worldY;
+      std::vector<uint8_t> lattice;
+      std::vector<int64_t> tracked;
+      int nCounts;
+      int historyStart;
+      std::vector<int64_t> history;
+
+      int getHistoryLength();
+      int64_t getCount( int row, int eleIndex );
+};
+
+// A position clicked in the viewer, and how far from it
+// the Atom tracked may be
+class TrackRequest
+{
+   public:
+      int x;
+      int y;
+      int maxOffset;
+};
+
+// Runs the simulation on its own thread, publishing
+// Snapshots for the gui to draw at its own pace
+class Worker : public QThread
+{
+   Q_OBJECT
+
+   public:
+      // Constructor
+      Worker( Options* initOptions, Sim* initSim, QObject* parent = 0 );
+
+      void stop();
+      void record();
+      void publish();
+      bool takeSnapshot( Snapshot* dest );
+      void requestTrack( int x, int y, int maxOffset );
+
+   protected:
+      void run();
+
+   private:
+      Options* o;
+      Sim* sim;
+      QAtomicInt stopRequested;
+
+      // Snapshots are published alternately into the two
+      // buffers; front is the buffer published last, reading
+      // the one being copied by the gui, and taken the
+      // sequence of the Snapshot the gui copied last
+      Snapshot buffers[2];
+      QAtomicInt front;
+      QAtomicInt reading;
+      QAtomicInt taken;
+      int published;
+
+      // Counts recorded since the first iteration not known
+      // to be plotted; the first publishedRows were in the
+      // last Snapshot published
+      int historyStart;
+      std::vector<int64_t> history;
+      int publishedRows;
+
+      // Positions clicked in the viewer, near which atoms
+      // are tracked between iterations
+      QMutex trackLock;
+      std::vector<TrackRequest> trackRequests;
+      void applyTrackRequests();
+};
+
+#endif /* HAVE_QT */
+#endif /* WORKER_H */